@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2026 ExactCODE GmbH Germany.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2. A copy of the GNU General
+ * Public License can be found in the file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANT-
+ * ABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * Alternatively, commercial licensing options are available from the
+ * copyright holder ExactCODE GmbH Germany.
+ */
+
+/*
+ * Builds the precomputed LogoRepresentation of a logo image, to be
+ * loaded with LogoRepresentation::Read() instead of recomputing all the
+ * rotated, reduced contour sets on each start.
+ */
+
+#include <stdio.h>
+
+#include <iostream>
+
+#include "ArgumentList.hh"
+#include "Codecs.hh"
+#include "optimize2bw.hh"
+
+#include "ContourMatching.hh"
+
+
+using namespace Utility;
+
+
+int main (int argc, char* argv[])
+{
+  ArgumentList arglist;
+
+  // setup the argument list
+  Argument<bool> arg_help ("", "help",
+			   "display this help text and exit");
+  Argument<std::string> arg_input ("i", "input", "logo image file",
+                                   1, 1);
+
+  Argument<std::string> arg_output ("o", "output", "representation output file",
+				    1, 1);
+
+  // optimize2bw options
+
+  Argument<int> arg_low ("l", "low",
+			 "low normalization value", 0, 0, 1);
+  Argument<int> arg_high ("h", "high",
+			  "high normalization value", 0, 0, 1);
+
+  Argument<int> arg_threshold ("t", "threshold",
+			       "bi-level threshold value", 0, 0, 1);
+
+  Argument<int> arg_radius ("r", "radius",
+			    "\"unsharp mask\" radius", 0, 0, 1);
+
+  Argument<double> arg_sd ("sd", "standard-deviation",
+			   "standard deviation for Gaussian distribution", 0.0, 0, 1);
+
+  // representation options, as for the matching
+
+  Argument<unsigned int> arg_features("F", "features", "maximum number of logo features",
+				      (unsigned int)10, 0, 1, false, false);
+
+  Argument<unsigned int> arg_tolerance("T", "tolerance", "tolerated maximum average distance",
+				       (unsigned int)20, 0, 1, false, false);
+
+  Argument<double> arg_angle("A", "angle", "maximum rotation angle for pre-matching",
+			     0.0, 0, 1);
+
+  Argument<double> arg_step("S", "step", "rotation angle increment for pre-matching",
+			    0.0, 0, 1);
+
+  Argument<unsigned int> arg_shift("R", "reduction", "coordinate bit reduction for pre-matching",
+				   (unsigned int)3, 0, 1, false, false);
+
+  arglist.Add (&arg_help);
+  arglist.Add (&arg_input);
+  arglist.Add (&arg_output);
+  arglist.Add (&arg_low);
+  arglist.Add (&arg_high);
+  arglist.Add (&arg_threshold);
+  arglist.Add (&arg_radius);
+  arglist.Add (&arg_sd);
+  arglist.Add (&arg_features);
+  arglist.Add (&arg_tolerance);
+  arglist.Add (&arg_angle);
+  arglist.Add (&arg_step);
+  arglist.Add (&arg_shift);
+
+  // parse the specified argument list - and maybe output the Usage
+  if (!arglist.Read (argc, argv) || arg_help.Get() == true)
+    {
+      std::cerr << "Logo representation builder" << std::endl
+                << "Usage:" << std::endl;
+
+      arglist.Usage (std::cerr);
+      return 1;
+    }
+
+  Image image;
+  if (!ImageCodec::Read (arg_input.Get(), image)) {
+    std::cerr << "Error reading input file." << std::endl;
+    return 1;
+  }
+
+  int low = arg_low.Get();
+  int high = arg_high.Get();
+  int threshold = arg_threshold.Get();
+  int radius = 3;
+  double sd = 2.1;
+
+  if (arg_radius.Get() != 0)
+    radius = arg_radius.Get();
+  if (arg_sd.Get() != 0)
+    sd = arg_sd.Get();
+
+  optimize2bw (image, low, high, threshold, 0, radius, sd);
+
+  if (threshold == 0)
+    threshold = 200;
+
+  Contours contours (image, threshold);
+
+  LogoRepresentation rep (&contours, arg_features.Get(), arg_tolerance.Get(),
+			  arg_shift.Get(), arg_angle.Get(), arg_step.Get());
+
+  FILE* f = fopen (arg_output.Get().c_str(), "wb");
+  if (!f) {
+    std::cerr << "Error opening output file." << std::endl;
+    return 1;
+  }
+
+  bool ok = rep.Write (f);
+  if (fclose (f) != 0)
+    ok = false;
+
+  if (!ok) {
+    std::cerr << "Error writing output file." << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
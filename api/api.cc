@@ -18,6 +18,7 @@
  */
 
 #include <math.h>
+#include <string.h>
 
 #include <string>
 #include <vector>
@@ -42,6 +43,7 @@
 #include "Scanner.hh"
 
 #include <vectorial.hh>
+#include <profile.hh>
 
 #include "api.hh"
 
@@ -124,6 +126,11 @@ bool decodeImageFile (Image* image, const char* filename)
   return ImageCodec::Read (filename, *image);
 }
 
+int probeImageFile (Image* image, const char* filename, int index)
+{
+  return ImageCodec::Probe (filename, *image, index);
+}
+
 void encodeImage (char **s, int *slen,
 		  Image* image, const char* codec, int quality,
 		  const char* compression)
@@ -195,6 +202,11 @@ const char* imageColorspace (Image* image)
   return colorspace_name (*image);
 }
 
+const char* imageCompression (Image* image)
+{
+  return image->getCompression().c_str();
+}
+
 void imageSetXres (Image* image, int xres)
 {
   image->setResolutionX(xres);
@@ -262,9 +274,10 @@ void imageFlipY (Image* image)
   flipY (*image);
 }
 
-void imageScale (Image* image, double factor, double yfactor)
+bool imageScale (Image* image, double factor, double yfactor, const char* filter)
 {
-  scale (*image, factor, yfactor != .0 ? yfactor : factor);
+  return scale_by_name (*image, filter ? filter : "",
+			factor, yfactor != .0 ? yfactor : factor);
 }
 
 void imageBoxScale (Image* image, double factor, double yfactor)
@@ -282,6 +295,21 @@ void imageBilinearScale (Image* image, double factor, double yfactor)
   bilinear_scale (*image, factor, yfactor != .0 ? yfactor : factor);
 }
 
+void imageBicubicScale (Image* image, double factor, double yfactor)
+{
+  bicubic_scale (*image, factor, yfactor != .0 ? yfactor : factor);
+}
+
+void imageLanczosScale (Image* image, double factor, double yfactor)
+{
+  resample_scale (*image, factor, yfactor != .0 ? yfactor : factor, RESAMPLE_LANCZOS3);
+}
+
+void imageMitchellScale (Image* image, double factor, double yfactor)
+{
+  resample_scale (*image, factor, yfactor != .0 ? yfactor : factor, RESAMPLE_MITCHELL);
+}
+
 void imageThumbnailScale (Image* image, double factor, double yfactor)
 {
   thumbnail_scale (*image, factor, yfactor != .0 ? yfactor : factor);
@@ -292,9 +320,11 @@ void imageCrop (Image* image, unsigned int x, unsigned int y, unsigned int w, un
   crop (*image, x, y, w, h);
 }
 
-void imageFastAutoCrop (Image* image)
+void imageFastAutoCrop (Image* image, bool all_sides,
+			unsigned int tolerance, unsigned int noise)
 {
-  fastAutoCrop (*image);
+  fastAutoCrop (*image, all_sides ? AUTO_CROP_ALL : AUTO_CROP_BOTTOM,
+		tolerance, noise);
 }
 
 // color controls
@@ -430,10 +460,50 @@ void pathFill(Path* path, Image* image)
   path->draw(*image, Path::fill_non_zero);
 }
 
+void setProfiling (bool enable)
+{
+  profile_enable (enable);
+}
+
+void profileBegin (const char* operation)
+{
+  profile_begin (operation);
+}
+
+void profileEnd ()
+{
+  profile_end ();
+}
+
+const std::string profileReport (bool json)
+{
+  std::stringstream stream;
+  profile_report (stream, json);
+  return stream.str();
+}
+
+void profileClear ()
+{
+  profile_clear ();
+}
+
 void imageOptimize2BW (Image* image, int low, int high,
 		       int threshold,
-		       int radius, double sd, int target_dpi)
-{
+		       int radius, double sd, int target_dpi,
+		       const char* adaptive, int window, double k)
+{
+  const bool local = adaptive && *adaptive;
+  adaptive_method_t method = ADAPTIVE_SAUVOLA;
+  if (local) {
+    const std::string name (adaptive);
+    if (name == "niblack")
+      method = ADAPTIVE_NIBLACK;
+    else if (name != "sauvola") {
+      std::cerr << "Unknown adaptive method: " << name << std::endl;
+      return;
+    }
+  }
+  
   optimize2bw (*image, low, high, threshold, 0 /* sloppy thr */,
 	       radius, sd);
   
@@ -453,7 +523,10 @@ void imageOptimize2BW (Image* image, int low, int high,
   if (!threshold)
     threshold = 200;
 
-  if (image->bps > 1)
+  // locally adaptive, directly yields the 1-bit data
+  if (local && image->bps > 1)
+    adaptive_threshold (*image, method, window, k);
+  else if (image->bps > 1)
     colorspace_gray8_to_gray1 (*image, threshold);
 }
 
@@ -469,8 +542,7 @@ Contours* newContours(Image* image, int low, int high,
   optimize2bw (*image, low, high, threshold, 0, radius, standard_deviation);
   if (threshold==0)
     threshold=200;
-  FGMatrix m(*image, threshold);
-  return new Contours(m);
+  return new Contours(*image, threshold);
 }
 
 void deleteContours(Contours* contours)
@@ -498,6 +570,27 @@ void deleteRepresentation(LogoRepresentation* representation)
   delete representation;
 }
 
+LogoRepresentation* loadRepresentation(const char* filename)
+{
+  FILE* f = fopen(filename, "rb");
+  if (!f)
+    return 0;
+  LogoRepresentation* representation = LogoRepresentation::Read(f);
+  fclose(f);
+  return representation;
+}
+
+bool saveRepresentation(LogoRepresentation* representation, const char* filename)
+{
+  FILE* f = fopen(filename, "wb");
+  if (!f)
+    return false;
+  bool ret = representation->Write(f);
+  if (fclose(f) != 0)
+    ret = false;
+  return ret;
+}
+
 double matchingScore(LogoRepresentation* representation, Contours* image_contours)
 {
   return representation->Score(image_contours);
@@ -545,6 +638,42 @@ void drawMatchedContours(LogoRepresentation* representation, Image* image)
   }
 }
 
+LogoLibrary* newLogoLibrary()
+{
+  return new LogoLibrary;
+}
+
+void deleteLogoLibrary(LogoLibrary* library)
+{
+  delete library;
+}
+
+void logoLibraryAdd(LogoLibrary* library, LogoRepresentation* representation)
+{
+  library->Add(representation);
+}
+
+int matchLogoLibrary(LogoLibrary* library, Contours* image_contours, int k)
+{
+  return library->Match(image_contours, k > 0 ? k : 0).size();
+}
+
+LogoRepresentation* matchedLogo(LogoLibrary* library, int i)
+{
+  const std::vector<LogoLibrary::Result>& results = library->Results();
+  if (i < 0 || i >= (int)results.size())
+    return 0;
+  return results[i].logo;
+}
+
+double matchedLogoScore(LogoLibrary* library, int i)
+{
+  const std::vector<LogoLibrary::Result>& results = library->Results();
+  if (i < 0 || i >= (int)results.size())
+    return 0.0;
+  return results[i].score;
+}
+
 
 void imageNormalize (Image* image)
 {
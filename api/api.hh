@@ -71,6 +71,11 @@ bool decodeImage (Image* image, const std::string& data);
 // decode image from given filename
 bool decodeImageFile (Image* image, const char* filename);
 
+// only parse the header of the image with the given index in filename,
+// setting the image properties without decoding any pixel data, returns
+// the number of images in the file, or 0 if it could not be identified
+int probeImageFile (Image* image, const char* filename, int index = 0);
+
 
 // encode image to memory, the data is newly allocated and returned
 // return 0 i the image could not be decoded
@@ -103,6 +108,9 @@ int imageHeight (Image* image);
 // returns the name of the image colorspace such as gray, gray2, gray4, rgb8, rgb16, cymk8, cymk16 ...
 const char* imageColorspace (Image* image);
 
+// returns the compression of a probed file, such as g4, lzw, jpeg, ...
+const char* imageCompression (Image* image);
+
 // returns X and Y resolution
 int imageXres (Image* image);
 int imageYres (Image* image);
@@ -133,20 +141,26 @@ void imageFlipX (Image* image);
 void imageFlipY (Image* image);
 
 // best scale (or thru the codec (e.g. JPEG)) or explicit algorithm
-// if yfactor is not specified, the same factor is used for both directions
-void imageScale (Image* image, double factor, double yfactor = .0);
+// if yfactor is not specified, the same factor is used for both directions,
+// the filter of imageScale may be any of the explicit ones, e.g. "lanczos"
+bool imageScale (Image* image, double factor, double yfactor = .0,
+		 const char* filter = "");
 void imageNearestScale (Image* image, double factor, double yfactor = .0);
 void imageBoxScale (Image* image, double factor, double yfactor = .0);
 void imageBilinearScale (Image* image, double factor, double yfactor = .0);
+void imageBicubicScale (Image* image, double factor, double yfactor = .0);
+void imageLanczosScale (Image* image, double factor, double yfactor = .0);
+void imageMitchellScale (Image* image, double factor, double yfactor = .0);
 void imageThumbnailScale (Image* image, double factor, double yfactor = .0);
 
 void imageCrop (Image* image, unsigned int x, unsigned int y, unsigned int w, unsigned int h);
 
 // fast auto crop by equal background color
-// (currently only crops the bottom, might be expanded in the
-//  future to allow top, left, right as well with always just
-//  the bottom crop enabled by default)
-void imageFastAutoCrop (Image* image);
+// (by default only crops the bottom, with all_sides the top, left
+//  and right as well; tolerance is the difference allowed per sample,
+//  noise the number of differing pixels a border line may have)
+void imageFastAutoCrop (Image* image, bool all_sides = false,
+			unsigned int tolerance = 0, unsigned int noise = 0);
 
 // color controls
 
@@ -187,11 +201,24 @@ void imageDrawTextOnPath(Image* image, Path* path, char* text,
 #endif
 
 
+// profiling, as econvert --profile: records wall and CPU time, allocated
+// image memory, the peak image buffer size, deferred decodes and codec
+// fast paths (e.g. JPEG DCT scaling) for each operation from
+// profileBegin until profileEnd, the report is a table or JSON
+void setProfiling (bool enable);
+void profileBegin (const char* operation);
+void profileEnd ();
+const std::string profileReport (bool json = false);
+void profileClear ();
+
 // advanced all-in-one algorithms
+// (an unknown adaptive method leaves the image untouched)
 void imageOptimize2BW (Image* image, int low = 0, int high = 255,
 		       int threshold = 170,
 		       int radius = 3, double standard_deviation = 2.3,
-		       int target_dpi = 0);
+		       int target_dpi = 0,
+		       const char* adaptive = 0 /* "sauvola", "niblack" */,
+		       int window = 0, double k = 0);
 // remeber: the margin will be rounded down to a multiple of 8, ...
 bool imageIsEmpty (Image* image, double percent, int margin);
 
@@ -317,6 +344,11 @@ LogoRepresentation* newRepresentation(Contours* logo_contours,
 
 void deleteRepresentation(LogoRepresentation* representation);
 
+// precomputed representation, e.g. built by ContourMatching/logorep,
+// loading returns 0 on error
+LogoRepresentation* loadRepresentation(const char* filename);
+bool saveRepresentation(LogoRepresentation* representation, const char* filename);
+
 double matchingScore(LogoRepresentation* representation, Contours* image_contours);
 
 // theese are valid after call to MatchingScore()
@@ -328,3 +360,21 @@ int inverseLogoTranslationX(LogoRepresentation* representation, Image* image);
 int inverseLogoTranslationY(LogoRepresentation* representation, Image* image);
 
 void drawMatchedContours(LogoRepresentation* representation, Image* image);
+
+// many logos matched against one image in one go, the image contours are
+// prepared once and the logos scored in parallel
+class LogoLibrary;
+
+LogoLibrary* newLogoLibrary();
+void deleteLogoLibrary(LogoLibrary* library);
+
+// the representation is not owned by the library
+void logoLibraryAdd(LogoLibrary* library, LogoRepresentation* representation);
+
+// returns the number of matches, the k best (or all for k = 0), best first
+int matchLogoLibrary(LogoLibrary* library, Contours* image_contours, int k = 0);
+
+// theese are valid after call to matchLogoLibrary(), the logoAngle() and
+// logoTranslation*() of the matched representations are valid as well
+LogoRepresentation* matchedLogo(LogoLibrary* library, int i);
+double matchedLogoScore(LogoLibrary* library, int i);
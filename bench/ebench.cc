@@ -0,0 +1,495 @@
+/*
+ * The ExactImage library's performance regression benchmark.
+ * Copyright (C) 2016 René Rebe, ExactCODE GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2. A copy of the GNU General
+ * Public License can be found in the file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANT-
+ * ABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * Alternatively, commercial licensing options are available from the
+ * copyright holder ExactCODE GmbH Germany.
+ */
+
+/* Generates deterministic, synthetic A4 pages in memory (bi-level text,
+ * gray, RGB photo and CMYK at 150, 300 and 600 dpi) and times each
+ * operation and codec on them.
+ *
+ * Each measurement runs in a forked child so the reported peak RSS is
+ * not polluted by the previous operations. The result is printed as
+ * tab separated lines, one per measurement, to be diffed between
+ * builds, e.g.: make bench > new.txt; diff old.txt new.txt
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "config.h"
+
+#include "ArgumentList.hh"
+
+#include "Image.hh"
+#include "Codecs.hh"
+
+#include "Colorspace.hh"
+
+#include "scale.hh"
+#include "rotate.hh"
+#include "crop.hh"
+#include "Matrix.hh"
+#include "GaussianBlur.hh"
+#include "optimize2bw.hh"
+#include "empty-page.hh"
+#include "riemersma.h"
+#include "floyd-steinberg.h"
+
+#include "api/api.cc"
+
+using namespace Utility;
+
+enum page_t {
+  BILEVEL = 1,
+  GRAY = 2,
+  PHOTO = 4,
+  CMYK = 8,
+  ALL = BILEVEL | GRAY | PHOTO | CMYK
+};
+
+static const char* page_name (page_t type)
+{
+  switch (type) {
+  case BILEVEL: return "bilevel";
+  case GRAY: return "gray";
+  case PHOTO: return "rgb";
+  case CMYK: return "cmyk";
+  default: return "unknown";
+  }
+}
+
+// simple LCG, so the pages are the same on every host and run
+static uint32_t seed = 0;
+static inline uint32_t rnd ()
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) & 0x7fff;
+}
+
+static void generate_page (Image& image, page_t type, int dpi)
+{
+  // A4
+  const int w = 210 * dpi * 10 / 254;
+  const int h = 297 * dpi * 10 / 254;
+  seed = dpi;
+
+  image.bps = 8;
+  image.spp = type == PHOTO ? 3 : type == CMYK ? 4 : 1;
+  image.resize (w, h);
+  image.setResolution (dpi, dpi);
+
+  uint8_t* data = image.getRawData();
+  const unsigned stride = image.stride();
+
+  switch (type) {
+  case BILEVEL:
+  case GRAY:
+    {
+      // paper with some noise, and lines of text-like glyph blocks
+      for (int y = 0; y < h; ++y)
+	for (int x = 0; x < w; ++x)
+	  data[y * stride + x] = 0xf0 + (rnd() & 0xf) - (type == GRAY ? y * 0x40 / h : 0);
+
+      const int line = dpi / 6, glyph = dpi / 12;
+      for (int y = dpi; y + line < h - dpi; y += line)
+	for (int x = dpi; x + glyph < w - dpi; x += glyph + glyph / 4) {
+	  if (rnd() % 7 == 0) // word space
+	    continue;
+	  const int gh = glyph / 2 + rnd() % (glyph / 2);
+	  const int stroke = std::max (1, dpi / 100);
+	  for (int gy = line - gh; gy < line; ++gy)
+	    for (int gx = 0; gx < glyph; ++gx)
+	      if (gx < stroke || gy < line - gh + stroke || (gx + gy) % (glyph / 2) < stroke)
+		data[(y + gy) * stride + x + gx] = rnd() & 0x1f;
+	}
+    }
+    break;
+
+  case PHOTO:
+  case CMYK:
+    {
+      // smooth gradients, some circles and noise
+      const int spp = image.spp;
+      for (int y = 0; y < h; ++y) {
+	uint8_t* p = data + y * stride;
+	for (int x = 0; x < w; ++x) {
+	  const int dx = x - w / 2, dy = y - h / 3;
+	  const int r = (int)sqrt (dx * dx + dy * dy) * 4 / dpi;
+	  for (int c = 0; c < spp; ++c)
+	    *p++ = ((x * (c + 1) * 255 / w) + (y * (spp - c) * 255 / h) + r * 8 * c
+		    + (rnd() & 0x7)) & 0xff;
+	}
+      }
+    }
+    break;
+
+  default:
+    break;
+  }
+
+  if (type == BILEVEL)
+    colorspace_gray8_to_gray1 (image);
+}
+
+// the operations
+
+static void op_nearest_scale (Image& image) { nearest_scale (image, 0.5, 0.5); }
+static void op_box_scale (Image& image) { box_scale (image, 0.5, 0.5); }
+static void op_bilinear_scale (Image& image) { bilinear_scale (image, 0.5, 0.5); }
+static void op_bilinear_upscale (Image& image) { bilinear_scale (image, 1.25, 1.25); }
+static void op_bicubic_scale (Image& image) { bicubic_scale (image, 0.5, 0.5); }
+static void op_bicubic_upscale (Image& image) { bicubic_scale (image, 1.25, 1.25); }
+static void op_lanczos_scale (Image& image) { resample_scale (image, 0.5, 0.5, RESAMPLE_LANCZOS3); }
+static void op_mitchell_scale (Image& image) { resample_scale (image, 0.5, 0.5, RESAMPLE_MITCHELL); }
+#ifndef _MSC_VER
+static void op_ddt_scale (Image& image) { ddt_scale (image, 0.5, 0.5); }
+#endif
+static void op_thumbnail_scale (Image& image) { thumbnail_scale (image, 0.125, 0.125); }
+
+static void op_rotate90 (Image& image) { rotate (image, 90, background_color); }
+static void op_rotate180 (Image& image) { rotate (image, 180, background_color); }
+static void op_rotate_arbitrary (Image& image) { rotate (image, 3.5, background_color); }
+static void op_flipx (Image& image) { flipX (image); }
+static void op_flipy (Image& image) { flipY (image); }
+
+static void op_convolve (Image& image)
+{
+  matrix_type matrix[] = { 0, -1,  0,
+			  -1,  5, -1,
+			   0, -1,  0 };
+  convolution_matrix (image, matrix, 3, 3, (matrix_type)1.0);
+}
+
+static void op_blur (Image& image) { GaussianBlur (image, 2.0); }
+static void op_optimize2bw (Image& image) { optimize2bw (image); }
+
+static void op_to_gray (Image& image) { colorspace_by_name (image, "gray"); }
+static void op_to_rgb (Image& image) { colorspace_by_name (image, "rgb"); }
+static void op_to_bilevel (Image& image) { colorspace_by_name (image, "bw"); }
+
+static void op_floyd_steinberg (Image& image) { FloydSteinberg (image, 2); }
+static void op_riemersma (Image& image) { Riemersma (image, 2); }
+
+static void op_empty_page (Image& image) { detect_empty_page (image); }
+static void op_fast_auto_crop (Image& image) { fastAutoCrop (image); }
+
+static void op_contours (Image& image)
+{
+  Contours* contours = newContours (&image);
+  deleteContours (contours);
+}
+
+static void op_contour_matching (Image& image)
+{
+  // use a region of the page itself as logo
+  Image* logo = copyImageCropRotate (&image, image.w / 4, image.h / 4,
+				     image.w / 8, image.h / 16, 0);
+  Contours* logo_contours = newContours (logo);
+  LogoRepresentation* representation = newRepresentation (logo_contours);
+
+  Contours* contours = newContours (&image);
+  matchingScore (representation, contours);
+
+  deleteContours (contours);
+  deleteRepresentation (representation);
+  deleteContours (logo_contours);
+  deleteImage (logo);
+}
+
+static void op_barcodes (Image& image)
+{
+  char** codes = imageDecodeBarcodes (&image, "code39|code128|code25|ean13|ean8|upca|upce");
+  for (char** it = codes; *it; ++it)
+    free (*it);
+  free (codes);
+}
+
+static const struct {
+  const char* name;
+  void (*op) (Image& image);
+  int types;
+  int max_dpi; // to skip too slow, or too memory hungry combinations
+} operations [] = {
+  { "nearest-scale", op_nearest_scale, ALL, 600 },
+  { "box-scale", op_box_scale, ALL, 600 },
+  { "bilinear-scale", op_bilinear_scale, ALL, 600 },
+  { "bilinear-upscale", op_bilinear_upscale, ALL, 600 },
+  { "bicubic-scale", op_bicubic_scale, ALL, 600 },
+  { "bicubic-upscale", op_bicubic_upscale, ALL, 600 },
+  { "lanczos-scale", op_lanczos_scale, ALL, 600 },
+  { "mitchell-scale", op_mitchell_scale, ALL, 600 },
+#ifndef _MSC_VER
+  { "ddt-scale", op_ddt_scale, GRAY | PHOTO, 150 }, // stack VLA
+#endif
+  { "thumbnail-scale", op_thumbnail_scale, ALL, 600 },
+  { "rotate90", op_rotate90, ALL, 600 },
+  { "rotate180", op_rotate180, ALL, 600 },
+  { "rotate-arbitrary", op_rotate_arbitrary, ALL, 600 },
+  { "flipX", op_flipx, ALL, 600 },
+  { "flipY", op_flipy, ALL, 600 },
+  { "convolve3x3", op_convolve, GRAY | PHOTO, 600 },
+  { "gaussian-blur", op_blur, GRAY | PHOTO, 600 },
+  { "optimize2bw", op_optimize2bw, GRAY | PHOTO, 600 },
+  { "colorspace-gray", op_to_gray, ALL, 600 },
+  { "colorspace-rgb", op_to_rgb, ALL, 600 },
+  { "colorspace-bw", op_to_bilevel, GRAY | PHOTO, 600 },
+  { "floyd-steinberg", op_floyd_steinberg, GRAY | PHOTO, 600 },
+  { "riemersma", op_riemersma, GRAY | PHOTO, 600 },
+  { "empty-page", op_empty_page, BILEVEL | GRAY | PHOTO, 600 },
+  { "fast-auto-crop", op_fast_auto_crop, ALL, 600 },
+  { "contours", op_contours, BILEVEL | GRAY, 300 },
+  { "contour-matching", op_contour_matching, BILEVEL | GRAY, 150 },
+  { "barcodes", op_barcodes, BILEVEL | GRAY, 600 },
+};
+
+static const struct {
+  const char* codec;
+  int types;
+} codecs [] = {
+  { "jpeg", GRAY | PHOTO | CMYK },
+  { "jp2", GRAY | PHOTO },
+  { "png", ALL },
+  { "tiff", ALL },
+  { "gif", BILEVEL | GRAY },
+  { "bmp", ALL },
+  { "pnm", BILEVEL | GRAY | PHOTO },
+  { "tga", GRAY | PHOTO },
+  { "pcx", BILEVEL | GRAY | PHOTO },
+  { "xpm", BILEVEL },
+  { "pdf", BILEVEL | GRAY | PHOTO },
+  { "ps", BILEVEL | GRAY | PHOTO },
+};
+
+static double now ()
+{
+  struct timeval tv;
+  gettimeofday (&tv, 0);
+  return tv.tv_sec + tv.tv_usec / 1000000.;
+}
+
+static double cpu_time ()
+{
+  struct rusage usage;
+  getrusage (RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1000000. +
+         usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1000000.;
+}
+
+static void report (const std::string& name, page_t type, const Image& page,
+		    double wall, double cpu, int repeat)
+{
+  struct rusage usage;
+  getrusage (RUSAGE_SELF, &usage);
+
+  const double pixels = (double)page.w * page.h;
+  wall /= repeat; cpu /= repeat;
+
+  printf ("%s\t%s\t%d\t%dx%d\t%.3f\t%.3f\t%.2f\t%.2f\t%ld\n",
+	  name.c_str(), page_name (type), page.resolutionX(), page.w, page.h,
+	  wall * 1000, cpu * 1000,
+	  wall > 0 ? pixels / wall / 1000000 : 0, wall * 1000000000 / pixels,
+	  (long)usage.ru_maxrss);
+  fflush (stdout);
+}
+
+// run f in a child process, to isolate crashes and the peak RSS
+template <typename F>
+static void measure (F f)
+{
+  fflush (stdout);
+  pid_t pid = fork ();
+  if (pid == 0) {
+    f();
+    fflush (stdout);
+    _exit (0);
+  }
+  else if (pid > 0) {
+    int status = 0;
+    waitpid (pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status))
+      std::cerr << "ebench: child failed, status: " << status << std::endl;
+  }
+  else
+    f(); // no fork, no isolation
+}
+
+struct run_operation
+{
+  run_operation (int _i, page_t _type, Image& _page, int _repeat)
+    : i(_i), type(_type), page(_page), repeat(_repeat) {}
+
+  void operator() ()
+  {
+    double wall = 0, cpu = 0;
+    for (int r = 0; r < repeat; ++r) {
+      Image image; image = page;
+      double t = now (), c = cpu_time ();
+      operations[i].op (image);
+      wall += now () - t; cpu += cpu_time () - c;
+    }
+    report (operations[i].name, type, page, wall, cpu, repeat);
+  }
+
+  int i; page_t type; Image& page; int repeat;
+};
+
+struct run_codec
+{
+  run_codec (int _i, page_t _type, Image& _page, int _repeat)
+    : i(_i), type(_type), page(_page), repeat(_repeat) {}
+
+  void operator() ()
+  {
+    const std::string codec = codecs[i].codec;
+    std::string encoded;
+
+    double wall = 0, cpu = 0;
+    for (int r = 0; r < repeat; ++r) {
+      std::ostringstream stream;
+      double t = now (), c = cpu_time ();
+      if (!ImageCodec::Write (&stream, page, codec, "")) {
+	std::cerr << "ebench: " << codec << " can not write "
+		  << page_name (type) << std::endl;
+	return;
+      }
+      wall += now () - t; cpu += cpu_time () - c;
+      encoded = stream.str ();
+    }
+    report (codec + "-encode", type, page, wall, cpu, repeat);
+
+    wall = cpu = 0;
+    for (int r = 0; r < repeat; ++r) {
+      std::istringstream stream (encoded);
+      Image image;
+      double t = now (), c = cpu_time ();
+      if (ImageCodec::Read (&stream, image, codec) <= 0) {
+	// write-only formats, such as PDF and PS
+	return;
+      }
+      image.getRawData (); // force deferred decoding
+      wall += now () - t; cpu += cpu_time () - c;
+    }
+    report (codec + "-decode", type, page, wall, cpu, repeat);
+
+    // header-only identification, per file: files/s = 1000 / wall-ms
+    const int probes = 100;
+    std::istringstream stream (encoded);
+    wall = cpu = 0;
+    for (int r = 0; r < repeat; ++r) {
+      double t = now (), c = cpu_time ();
+      for (int p = 0; p < probes; ++p) {
+	stream.clear (); stream.seekg (0);
+	Image image;
+	if (ImageCodec::Probe (&stream, image, codec) <= 0)
+	  return;
+      }
+      wall += now () - t; cpu += cpu_time () - c;
+    }
+    report (codec + "-probe", type, page, wall, cpu, repeat * probes);
+  }
+
+  int i; page_t type; Image& page; int repeat;
+};
+
+int main (int argc, char* argv[])
+{
+  ArgumentList arglist;
+
+  // setup the argument list
+  Argument<bool> arg_help ("h", "help",
+			   "display this help text and exit");
+  arglist.Add (&arg_help);
+
+  Argument<int> arg_dpi ("d", "dpi",
+			 "page resolution(s) to benchmark, default: 150, 300 and 600",
+			 0, 0, 3);
+  arglist.Add (&arg_dpi);
+
+  Argument<std::string> arg_filter ("f", "filter",
+				    "only run operations and codecs containing this string",
+				    0, 1);
+  arglist.Add (&arg_filter);
+
+  Argument<int> arg_repeat ("r", "repeat",
+			    "repetitions per measurement, the average is reported",
+			    1, 0, 1);
+  arglist.Add (&arg_repeat);
+
+  // parse the specified argument list - and maybe output the Usage
+  if (!arglist.Read (argc, argv))
+    return 1;
+
+  if (arg_help.Get() == true)
+    {
+      std::cerr << "ExactImage benchmark (ebench), version " VERSION << std::endl
+                << "Copyright (C) 2016 René Rebe, ExactCODE GmbH" << std::endl
+                << "Usage:" << std::endl;
+
+      arglist.Usage (std::cerr);
+      return 1;
+    }
+
+  std::vector<int> dpis;
+  for (int i = 0; i < arg_dpi.Size(); ++i)
+    dpis.push_back (arg_dpi.Get(i));
+  if (dpis.empty()) {
+    dpis.push_back (150);
+    dpis.push_back (300);
+    dpis.push_back (600);
+  }
+
+  const std::string filter = arg_filter.Size() ? arg_filter.Get() : "";
+  const int repeat = std::max (1, arg_repeat.Get());
+
+  printf ("# operation\tpage\tdpi\tsize\twall-ms\tcpu-ms\tMPixel/s\tns/pixel\tpeak-RSS-KiB\n");
+
+  const page_t types[] = { BILEVEL, GRAY, PHOTO, CMYK };
+  for (unsigned d = 0; d < dpis.size(); ++d)
+    for (unsigned t = 0; t < sizeof(types) / sizeof(*types); ++t)
+      {
+	Image page;
+	generate_page (page, types[t], dpis[d]);
+
+	for (unsigned i = 0; i < sizeof(operations) / sizeof(*operations); ++i) {
+	  if (!(operations[i].types & types[t]) || dpis[d] > operations[i].max_dpi)
+	    continue;
+	  if (!filter.empty() && std::string(operations[i].name).find(filter) == std::string::npos)
+	    continue;
+	  measure (run_operation (i, types[t], page, repeat));
+	}
+
+	for (unsigned i = 0; i < sizeof(codecs) / sizeof(*codecs); ++i) {
+	  if (!(codecs[i].types & types[t]))
+	    continue;
+	  if (!filter.empty() && std::string(codecs[i].codec).find(filter) == std::string::npos)
+	    continue;
+	  measure (run_codec (i, types[t], page, repeat));
+	}
+      }
+
+  return 0;
+}
@@ -17,12 +17,17 @@
 
 #include "Codecs.hh"
 #include "Colorspace.hh"
+#include "profile.hh"
 
 #include <ctype.h> // tolower
 
 #include <iostream>
 #include <fstream>
 
+#ifndef _MSC_VER
+#include <pthread.h>
+#endif
+
 std::list<ImageCodec::loader_ref>* ImageCodec::loader = 0;
 
 ImageCodec::ImageCodec ()
@@ -140,8 +145,10 @@ bool ImageCodec::Write (std::ostream* stream, Image& image,
   
  do_write:
   // reuse attached codec (if any and the image is unmodified)
-  if (image.getCodec() && !image.isModified() && image.getCodec()->getID() == it->loader->getID())
+  if (image.getCodec() && !image.isModified() && image.getCodec()->getID() == it->loader->getID()) {
+    profile_codec_fast_path ();
     return (image.getCodec()->writeImage (stream, image, quality, compress));
+  }
   else
     return (it->loader->writeImage (stream, image, quality, compress));
 }
@@ -177,6 +184,205 @@ ImageCodec* ImageCodec::MultiWrite (std::ostream* stream,
   return it->loader->instanciateForWrite(stream, compress);
 }
 
+// fallback for codecs without native multi-page reading
+class IndexedReader : public ImageCodec
+{
+public:
+  IndexedReader (std::istream* _stream, const std::string& _codec,
+		 const std::string& _decompress)
+    : stream(_stream), codec(_codec), decompress(_decompress), index(0), n(1) {}
+  
+  virtual std::string getID () { return codec; };
+  virtual bool writeImage (std::ostream* stream, Image& image,
+			   int quality, const std::string& compress) { return false; }
+  
+  virtual int Read (Image& image)
+  {
+    if (index >= n)
+      return 0;
+    
+    stream->clear ();
+    stream->seekg (0);
+    int ret = ImageCodec::Read (stream, image, codec, decompress, index);
+    if (ret <= 0)
+      return 0;
+    if (index++ == 0)
+      n = ret;
+    return n;
+  }
+  
+protected:
+  std::istream* stream;
+  std::string codec, decompress;
+  int index, n;
+};
+
+#ifndef _MSC_VER
+// decodes the next image in a background thread while the caller
+// processes the current one
+class ReadAheadReader : public ImageCodec
+{
+public:
+  ReadAheadReader (ImageCodec* _reader)
+    : reader(_reader), running(false), ret(0) {}
+  
+  ~ReadAheadReader ()
+  {
+    if (running)
+      pthread_join (thread, 0);
+    delete reader;
+  }
+  
+  virtual std::string getID () { return reader->getID(); };
+  virtual bool writeImage (std::ostream* stream, Image& image,
+			   int quality, const std::string& compress) { return false; }
+  
+  virtual int Read (Image& image)
+  {
+    if (!running)
+      decode (this); // first image, synchronously
+    else {
+      pthread_join (thread, 0);
+      running = false;
+    }
+    
+    const int n = ret;
+    if (n <= 0)
+      return 0;
+    
+    // hand the codec over together with the data, so codec fast paths
+    // (e.g. lossless JPEG rotation or writing the DCT unmodified) remain
+    ImageCodec* codec = next.isModified () ? 0 : next.detachCodec ();
+    image.copyTransferOwnership (next);
+    image.setDecoderID (next.getDecoderID ());
+    image.setCompression (next.getCompression ());
+    image.setCodec (codec);
+    
+    running = pthread_create (&thread, 0, decode, this) == 0;
+    if (!running)
+      decode (this);
+    
+    return n;
+  }
+  
+protected:
+  static void* decode (void* arg)
+  {
+    ReadAheadReader* self = (ReadAheadReader*) arg;
+    self->ret = self->reader->Read (self->next);
+    if (self->ret > 0)
+      self->next.getRawData (); // force deferred decoding
+    return 0;
+  }
+  
+  ImageCodec* reader;
+  Image next;
+  pthread_t thread;
+  bool running;
+  int ret;
+};
+#endif
+
+ImageCodec* ImageCodec::MultiRead (std::istream* stream,
+				   std::string codec, const std::string& decompress)
+{
+  std::transform (codec.begin(), codec.end(), codec.begin(), tolower);
+  
+  Args args (decompress);
+  const bool readahead = args.containsAndRemove ("readahead");
+  const std::string options = readahead ? args.str() : decompress;
+  
+  ImageCodec* reader = 0;
+  std::list<loader_ref>::iterator it;
+  if (loader)
+  for (it = loader->begin(); it != loader->end() && !reader; ++it)
+    {
+      if (!it->primary_entry || (codec.empty() && it->via_codec_only) ||
+	  (!codec.empty() && it->ext != codec))
+	continue;
+      
+      reader = it->loader->instanciateForRead (stream, options);
+      stream->clear ();
+      if (!reader)
+	stream->seekg (0);
+    }
+  
+  // codec not detected, or without native multi-page support
+  if (!reader)
+    reader = new IndexedReader (stream, codec, options);
+  
+#ifndef _MSC_VER
+  if (readahead)
+    reader = new ReadAheadReader (reader);
+#endif
+  
+  return reader;
+}
+
+int ImageCodec::Probe (std::istream* stream, Image& image,
+		       std::string codec, int index)
+{
+  std::transform (codec.begin(), codec.end(), codec.begin(), tolower);
+  
+  // detach any previous codec and pixel data, only the meta data is set
+  image.setCodec (0);
+  image.setRawData (0);
+  image.rowstride = 0;
+  image.setCompression ("");
+  
+  std::list<loader_ref>::iterator it;
+  if (loader)
+  for (it = loader->begin(); it != loader->end(); ++it)
+    {
+      if (codec.empty()) // try via magic
+	{
+	  if (it->primary_entry && !it->via_codec_only) {
+	    int res = it->loader->probeImage (stream, image, index);
+	    if (res > 0)
+	    {
+	      image.setDecoderID (it->loader->getID ());
+	      return res;
+	    }
+	    stream->clear ();
+	    stream->seekg (0);
+	  }
+	}
+      else // manual codec spec
+	{
+	  if (it->primary_entry && it->ext == codec) {
+	    int res = it->loader->probeImage (stream, image, index);
+	    if (res > 0)
+	      image.setDecoderID (it->loader->getID ());
+	    return res;
+	  }
+	}
+    }
+  
+  return false;
+}
+
+int ImageCodec::Probe (std::string file, Image& image, int index)
+{
+  std::string codec = getCodec (file);
+  
+  std::istream* s;
+  if (file != "-")
+    s = new std::ifstream (file.c_str(), std::ios::in | std::ios::binary);
+  else
+    s = &std::cin;
+  
+  if (!*s) {
+    if (s != &std::cin)
+      delete s;
+    return false;
+  }
+  
+  int res = Probe (s, image, codec, index);
+  if (s != &std::cin)
+    delete s;
+  return res;
+}
+
 // OLD API
 
 int ImageCodec::Read (std::string file, Image& image, const std::string& decompress, int index)
@@ -274,6 +480,11 @@ int ImageCodec::readImage (std::istream* stream, Image& image,
     return 0;
 }
 
+int ImageCodec::probeImage (std::istream* stream, Image& image, int index)
+{
+  return readImage(stream, image, "", index);
+}
+
 ImageCodec* ImageCodec::instanciateForWrite (std::ostream* stream, const std::string& compress)
 {
   return 0;
@@ -285,6 +496,16 @@ bool ImageCodec::Write (Image& image,
   return false;
 }
 
+ImageCodec* ImageCodec::instanciateForRead (std::istream* stream, const std::string& decompress)
+{
+  return 0;
+}
+
+int ImageCodec::Read (Image& image)
+{
+  return 0;
+}
+
 /*bool*/ void ImageCodec::decodeNow (Image* image)
 {
   // intentionally left blank
@@ -70,6 +70,24 @@ public:
   static ImageCodec* MultiWrite (std::ostream* stream,
 				 std::string codec, std::string ext = "", const std::string& compress = "");
   
+  // The read-side counterpart of MultiWrite: keeps the decoder state open
+  // and yields the images sequentially via Read(image), instead of
+  // re-opening and seeking to the index for every image. A "readahead"
+  // decompress option decodes the next image in the background, the
+  // attached codec is handed over with the image. Codecs
+  // without native support are read index by index. The stream must stay
+  // valid for the life-time of the returned instance.
+  static ImageCodec* MultiRead (std::istream* stream,
+				std::string codec = "", const std::string& decompress = "");
+  
+  // Header-only probing: only parses the header (IFD, etc.) of the indexed
+  // image and sets the geometry, sample format, resolution and compression,
+  // the pixel data is neither decoded nor allocated. Palette images report
+  // the de-paletted format Read yields. Returns the number of images, like Read.
+  static int Probe (std::istream* stream, Image& image,
+		    std::string codec = "", int index = 0);
+  static int Probe (std::string file, Image& image, int index = 0);
+  
   // OLD API, only left for compatibility.
   // Not const string& because the filename is parsed and the copy is changed intern.
   // 
@@ -85,6 +103,8 @@ public:
 			 const std::string& decompress);
   virtual int readImage (std::istream* stream, Image& image,
 			 const std::string& decompress, int index);
+  // falls back to a full readImage, if not implemented by the codec
+  virtual int probeImage (std::istream* stream, Image& image, int index);
 
   virtual bool writeImage (std::ostream* stream, Image& image,
 			   int quality, const std::string& compress) = 0;
@@ -93,6 +113,11 @@ public:
   virtual bool Write (Image& image,
 		      int quality = 75, const std::string& compress = "", int index = 0);
   
+  // for multi-page reading, returns 0 if the stream does not match
+  virtual ImageCodec* instanciateForRead (std::istream* stream, const std::string& decompress = "");
+  // yields the next image, returns the number of images, 0 when done or on error
+  virtual int Read (Image& image);
+  
   // not pure-virtual so not every codec needs a NOP
   virtual /*bool*/ void decodeNow (Image* image);
   
@@ -258,6 +258,97 @@ int BMPCodec::readImage (std::istream* stream, Image& image, const std::string&
   return i;
 }
 
+int BMPCodec::probeImage (std::istream* stream, Image& image, int index)
+{
+  char bType[2];
+  stream->read (bType, 2);
+  if (bType[0] != 'B' || bType[1] != 'M' || index > 0) {
+    stream->seekg (0);
+    return false;
+  }
+  
+  BMPInfoHeader info_hdr = {};
+  stream->seekg (sizeof(BMPFileHeader));
+  stream->read ((char*)&info_hdr.iSize, 4);
+  uint32_t n_clr_elems = 4;
+  
+  if (info_hdr.iSize == BIH_OS21SIZE) {
+    int16_t iShort;
+    stream->read ((char*)&iShort, 2);
+    info_hdr.iWidth = iShort;
+    stream->read ((char*)&iShort, 2);
+    info_hdr.iHeight = iShort;
+    stream->read ((char*)&iShort, 2);
+    stream->read ((char*)&iShort, 2);
+    info_hdr.iBitCount = iShort;
+    info_hdr.iCompression = BMPC_RGB;
+    n_clr_elems = 3;
+  }
+  else {
+    stream->read((char*)&info_hdr.iWidth, 4);
+    stream->read((char*)&info_hdr.iHeight, 4);
+    stream->read((char*)&info_hdr.iPlanes, 2);
+    stream->read((char*)&info_hdr.iBitCount, 2);
+    stream->read((char*)&info_hdr.iCompression, 4);
+    stream->read((char*)&info_hdr.iSizeImage, 4);
+    stream->read((char*)&info_hdr.iXPelsPerMeter, 4);
+    stream->read((char*)&info_hdr.iYPelsPerMeter, 4);
+    stream->read((char*)&info_hdr.iClrUsed, 4);
+    if (info_hdr.iSize == 16 || info_hdr.iSize == BIH_OS22SIZE)
+      n_clr_elems = 3;
+  }
+  
+  if (!*stream || info_hdr.iWidth <= 0 || info_hdr.iHeight == 0)
+    return false;
+  
+  image.w = info_hdr.iWidth;
+  image.h = std::abs(info_hdr.iHeight); // negative when upside-down
+  image.setResolution((2.54 * info_hdr.iXPelsPerMeter) / 100 + .5,
+		      (2.54 * info_hdr.iYPelsPerMeter) / 100 + .5);
+  
+  // color tables are expanded by readImage, report what it yields
+  if (info_hdr.iBitCount <= 8) {
+    int spp = 1, bps = info_hdr.iBitCount;
+    uint32_t clr_tbl_size = 1 << bps;
+    if (info_hdr.iClrUsed && info_hdr.iClrUsed < clr_tbl_size)
+      clr_tbl_size = info_hdr.iClrUsed;
+    
+    std::vector<uint8_t> clr_tbl (n_clr_elems * clr_tbl_size);
+    stream->seekg (sizeof(BMPFileHeader) + info_hdr.iSize);
+    stream->read ((char*)&clr_tbl[0], clr_tbl.size());
+    if (!*stream)
+      return false;
+    
+    std::vector<uint16_t> rmap (clr_tbl_size), gmap (clr_tbl_size), bmap (clr_tbl_size);
+    for (unsigned int i = 0; i < clr_tbl_size; ++i) {
+      // BMP maps have BGR order ...
+      rmap[i] = 0x101 * clr_tbl[i * n_clr_elems + 2];
+      gmap[i] = 0x101 * clr_tbl[i * n_clr_elems + 1];
+      bmap[i] = 0x101 * clr_tbl[i * n_clr_elems + 0];
+    }
+    colorspace_de_palette_format (spp, bps, clr_tbl_size,
+				  &rmap[0], &gmap[0], &bmap[0]);
+    image.spp = spp;
+    image.bps = bps;
+  } else {
+    image.spp = info_hdr.iBitCount == 32 ? 4 : 3;
+    image.bps = info_hdr.iBitCount == 48 ? 16 : 8;
+  }
+  
+  switch (info_hdr.iCompression) {
+  case BMPC_RGB: image.setCompression("none"); break;
+  case BMPC_RLE4:
+  case BMPC_RLE8: image.setCompression("rle"); break;
+  case BMPC_BITFIELDS:
+  case BMPC_ALPHABITFIELDS: image.setCompression("bitfields"); break;
+  case BMPC_JPEG: image.setCompression("jpeg"); break;
+  case BMPC_PNG: image.setCompression("png"); break;
+  default: image.setCompression("unknown");
+  }
+  
+  return true;
+}
+
 int BMPCodec::readImageWithoutFileHeader (std::istream* stream, Image& image, const std::string& decompres, BMPFileHeader* _file_hdr)
 {
   BMPFileHeader* file_hdr = _file_hdr;
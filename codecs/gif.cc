@@ -21,6 +21,7 @@
 #include "Colorspace.hh"
 
 #include <iostream>
+#include <vector>
 
 /* The way Interlaced image should. */
 static const int InterlacedOffset[] = { 0, 4, 2, 1 };
@@ -160,6 +161,74 @@ int GIFCodec::readImage (std::istream* stream, Image& image, const std::string&
   return true;
 }
 
+int GIFCodec::probeImage (std::istream* stream, Image& image, int index)
+{
+  { // quick magic check
+    char buf [3];
+    stream->read (buf, sizeof (buf));
+    stream->seekg (0);
+    if (buf[0] != 'G' || buf[1] != 'I' || buf[2] != 'F')
+      return false;
+  }
+  
+  if (index > 0)
+    return false;
+  
+  GifFileType* GifFile;
+  int GifError;
+  
+  // the logical screen descriptor, and the first image descriptor for
+  // its color map, the raster data is not decoded
+  if ((GifFile = DGifOpen (stream, &GIFInputFunc, &GifError)) == 0)
+    return false;
+  
+  image.w = GifFile->SWidth;
+  image.h = GifFile->SHeight;
+  image.spp = 1;
+  image.bps = 8;
+  image.setResolution(0, 0);
+  image.setCompression("lzw");
+  
+  // skip the extensions up to the first image descriptor
+  GifRecordType RecordType = TERMINATE_RECORD_TYPE;
+  GifByteType* Extension;
+  int ExtCode;
+  while (DGifGetRecordType(GifFile, &RecordType) != GIF_ERROR &&
+	 RecordType == EXTENSION_RECORD_TYPE) {
+    if (DGifGetExtension(GifFile, &ExtCode, &Extension) == GIF_ERROR)
+      Extension = 0, RecordType = TERMINATE_RECORD_TYPE;
+    while (Extension != 0)
+      if (DGifGetExtensionNext(GifFile, &Extension) == GIF_ERROR)
+	Extension = 0, RecordType = TERMINATE_RECORD_TYPE;
+    if (RecordType == TERMINATE_RECORD_TYPE)
+      break;
+  }
+  
+  // converted by readImage, report what it yields
+  if (RecordType == IMAGE_DESC_RECORD_TYPE &&
+      DGifGetImageDesc(GifFile) != GIF_ERROR) {
+    ColorMapObject* ColorMap = (GifFile->Image.ColorMap ? GifFile->Image.ColorMap :
+				GifFile->SColorMap);
+    if (ColorMap) {
+      std::vector<uint16_t> rmap (ColorMap->ColorCount),
+	gmap (ColorMap->ColorCount), bmap (ColorMap->ColorCount);
+      for (int i = 0; i < ColorMap->ColorCount; ++i) {
+	rmap[i] = ColorMap->Colors[i].Red << 8;
+	gmap[i] = ColorMap->Colors[i].Green << 8;
+	bmap[i] = ColorMap->Colors[i].Blue << 8;
+      }
+      int spp = image.spp, bps = image.bps;
+      colorspace_de_palette_format (spp, bps, ColorMap->ColorCount,
+				    &rmap[0], &gmap[0], &bmap[0]);
+      image.spp = spp;
+      image.bps = bps;
+    }
+  }
+  
+  DGifCloseFile(GifFile, &GifError);
+  return true;
+}
+
 bool GIFCodec::writeImage (std::ostream* stream, Image& image, int quality,
 			   const std::string& compress)
 {
@@ -19,9 +19,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 
@@ -97,6 +99,50 @@ void jpeg_compress_set_density (jpeg_compress_struct* dstinfo, const Image& imag
   }
 }
 
+// Entropy coding options, set on the pixel as well as on the lossless
+// coefficient path: optimized Huffman tables, a progressive scan script
+// (or forced baseline) and the restart interval in MCUs or MCU rows.
+struct jpeg_coding
+{
+  bool optimize, progressive, baseline;
+  int restart, restart_rows;
+  
+  jpeg_coding (Args& args)
+    : optimize(args.containsAndRemove("optimize")),
+      progressive(args.containsAndRemove("progressive")),
+      baseline(args.containsAndRemove("baseline")),
+      restart(0), restart_rows(0)
+  {
+    std::string arg = args.containsPrefixedAndRemove("restart=");
+    if (!arg.empty())
+      restart = atoi(arg.c_str());
+    arg = args.containsPrefixedAndRemove("restart-rows=");
+    if (!arg.empty())
+      restart_rows = atoi(arg.c_str());
+  }
+  
+  // whether the stored coefficients need to be re-encoded
+  bool any () const {
+    return optimize || progressive || baseline || restart || restart_rows;
+  }
+};
+
+// progressive: the source's scan mode, kept unless baseline is requested
+void jpeg_compress_set_coding (jpeg_compress_struct* cinfo, const jpeg_coding* coding,
+			       bool progressive = false)
+{
+  if (!coding)
+    return;
+  if (coding->optimize)
+    cinfo->optimize_coding = (boolean)TRUE;
+  if ((coding->progressive || progressive) && !coding->baseline)
+    jpeg_simple_progression(cinfo);
+  if (coding->restart > 0)
+    cinfo->restart_interval = coding->restart;
+  else if (coding->restart_rows > 0)
+    cinfo->restart_in_rows = coding->restart_rows;
+}
+
 /* *** source manager *** */
 
 typedef struct {
@@ -276,7 +322,9 @@ void cpp_stream_dest (j_compress_ptr cinfo, std::ostream* stream)
 /* *** back on-topic *** */
 
 JPEGCodec::JPEGCodec (Image* _image)
-  : ImageCodec (_image), colorspace(JCS_UNKNOWN)
+  : ImageCodec (_image), colorspace(JCS_UNKNOWN), pending(JXFORM_NONE),
+    pending_gray(false), pending_crop(false), mcu_w(8), mcu_h(8),
+    mcu_crop(false), pending_halve(0)
 {
 }
 
@@ -410,6 +458,7 @@ int JPEGCodec::readImage (std::istream* stream, Image& image, const std::string&
     codec->colorspace = JCS_YCCK;
   else if (args.containsAndRemove("rgb"))
     codec->colorspace = JCS_RGB;
+  codec->mcu_crop = args.containsAndRemove("mcu-crop");
   
   // parse Exif data, might contain non-identifiy orientation transform
   codec->parseExif(image);
@@ -422,15 +471,29 @@ bool JPEGCodec::writeImage (std::ostream* stream, Image& image, int quality,
 {
   Args args(compress);
   const bool debug = args.containsAndRemove("debug");
+  const jpeg_coding coding(args);
   
   // if the instance is freestanding it can only be called by the mux
   // if the cache is valid
   if (_image && !args.containsAndRemove("recompress")) {
-    // if meta information was modified re-encode the stream
-    if (image.isMetaModified()) {
+    // requantize and / or downscale the coefficients, after the lossless
+    // transformations were applied; as the downscaled image is new
+    // content, like a re-encode it is quantized to the requested quality
+    const bool requantize = args.containsAndRemove("requantize");
+    if (requantize || pending_halve) {
+      if (pendingTransform())
+	doTransform (image);
       if (debug)
-	std::cerr << "Re-encoding DCT coefficients (due meta changes)." << std::endl;
-      doTransform (JXFORM_NONE, image, stream);
+	std::cerr << "Requantizing and / or downscaling DCT coefficients." << std::endl;
+      if (!transcode (image, stream, quality, &coding))
+	return false;
+    }
+    // if meta information was modified, lossless transformations are
+    // pending or other entropy coding requested, re-encode the stream
+    else if (image.isMetaModified() || pendingTransform() || coding.any()) {
+      if (debug)
+	std::cerr << "Re-encoding DCT coefficients (due meta changes, transformations or coding)." << std::endl;
+      doTransform (image, stream, &coding);
     } else {
       if (debug)
 	std::cerr << "Writing unmodified DCT buffer." << std::endl;
@@ -512,6 +575,8 @@ bool JPEGCodec::writeImage (std::ostream* stream, Image& image, int quality,
     } 
   }
 
+  jpeg_compress_set_coding (&cinfo, &coding);
+  
   if (!args.str().empty())
     std::cerr << "JPEGCodec: Unrecognized encoding options '" << args.str() << "'" << std::endl;
   
@@ -556,54 +621,16 @@ T readExif(const void* raw_ptr, const bool big_endian)
     return ByteSwap<LittleEndianTraits, NativeEndianTraits, T>::Swap(v);
 }
 
-void JPEGCodec::parseExif (Image& image)
+// Parses the orientation and the resolution, in dpi, of the Exif TIFF
+// structure following the "Exif\0\0" signature of the APP1 segment.
+static void parseExifTIFF (const uint8_t* exif_data, unsigned length,
+			   uint16_t& orientation, uint32_t& xres, uint32_t& yres)
 {
-  // for now we're only interested in the orientation tag
-  // TODO: parse, provide and re-write the whole meta data
-  
-  const std::string& exif_data_p = private_copy.str();
-  const uint8_t* exif_data = (uint8_t*)exif_data_p.c_str();
-  
-  // check for JPEG SOI + Exif APP1
-  if (exif_data[0] != 0xFF ||
-      exif_data[1] != 0xD8)
-    return;
-
-  // check "Exif" header
-  for (int offset = 2; offset <= 20; offset = 20) {
-    if (exif_data[offset+0] == 0xFF &&
-        exif_data[offset+1] == 0xE1 &&
-        exif_data[offset+4] == 'E' &&
-        exif_data[offset+5] == 'x' &&
-        exif_data[offset+6] == 'i' &&
-        exif_data[offset+7] == 'f' &&
-        exif_data[offset+8] == 0 &&
-        exif_data[offset+9] == 0)
-    {
-      exif_data += offset;
-      break;
-    }
-
-    if (offset == 20)
-      return;
-  }
-
-  // Get the marker parameter length count
-  uint16_t length = readExif<uint16_t>(exif_data + 2, true); // always big-endian
-  if (length > exif_data_p.size()) {
-    std::cerr << "Exif header length limitted" << std::endl;
-    length = exif_data_p.size();
-  }
-  
-  // length includes itself, so must be at least 2 + Exif data length must be at least 6
-  if (length < 8)
-    return;
-  length -= 8;
+  orientation = 0;
+  xres = yres = 0;
   if (length < 12)
     return; // length of an IFD entry
   
-  exif_data += 10;
-
   // honor byte order
   bool big_endian;
   if (exif_data[0] == 0x49 && exif_data[1] == 0x49)
@@ -630,8 +657,7 @@ void JPEGCodec::parseExif (Image& image)
   offset += 2;
 
   // search for orientation tag in IFD0
-  uint16_t orientation = 0, unit = 0;
-  uint32_t xres = 0, yres = 0;
+  uint16_t unit = 0;
   
   for (; number_of_tags > 0; --number_of_tags, offset += 12) {
     if (offset > length - 12) break; // check end of data segment
@@ -697,7 +723,59 @@ void JPEGCodec::parseExif (Image& image)
       xres = xres * 254 / 100;
       yres = yres * 254 / 100;
     }
-    
+  }
+}
+
+void JPEGCodec::parseExif (Image& image)
+{
+  // for now we're only interested in the orientation tag
+  // TODO: parse, provide and re-write the whole meta data
+  
+  const std::string& exif_data_p = private_copy.str();
+  const uint8_t* exif_data = (uint8_t*)exif_data_p.c_str();
+  
+  // check for JPEG SOI + Exif APP1
+  if (exif_data[0] != 0xFF ||
+      exif_data[1] != 0xD8)
+    return;
+
+  // check "Exif" header
+  for (int offset = 2; offset <= 20; offset = 20) {
+    if (exif_data[offset+0] == 0xFF &&
+        exif_data[offset+1] == 0xE1 &&
+        exif_data[offset+4] == 'E' &&
+        exif_data[offset+5] == 'x' &&
+        exif_data[offset+6] == 'i' &&
+        exif_data[offset+7] == 'f' &&
+        exif_data[offset+8] == 0 &&
+        exif_data[offset+9] == 0)
+    {
+      exif_data += offset;
+      break;
+    }
+
+    if (offset == 20)
+      return;
+  }
+
+  // Get the marker parameter length count
+  uint16_t length = readExif<uint16_t>(exif_data + 2, true); // always big-endian
+  if (length > exif_data_p.size()) {
+    std::cerr << "Exif header length limitted" << std::endl;
+    length = exif_data_p.size();
+  }
+  
+  // length includes itself, so must be at least 2 + Exif data length must be at least 6
+  if (length < 8)
+    return;
+  length -= 8;
+  exif_data += 10;
+  
+  uint16_t orientation;
+  uint32_t xres, yres;
+  parseExifTIFF (exif_data, length, orientation, xres, yres);
+  
+  if (xres || yres) {
     // was already set?
     if (image.resolutionX() == 0 && image.resolutionY() == 0) {
       image.setResolution(xres, yres);
@@ -742,6 +820,12 @@ void JPEGCodec::parseExif (Image& image)
   
   jpeg_create_decompress (cinfo);
   
+  // apply the pending lossless operations first, halving is left to
+  // the scaled IDCT
+  if (pendingTransform())
+    doTransform (*image);
+  factor <<= pending_halve;
+  
   // Step 2: specify data source (eg, a file)
   private_copy.seekg (0);
   cpp_stream_src (cinfo, &private_copy);
@@ -801,23 +885,78 @@ void JPEGCodec::parseExif (Image& image)
 
 // in any case (we do not want artefacts): transformoption.trim = TRUE;
 
+// The eight lossless orientations as bits: transpose (4), followed by
+// horizontal (2) and vertical (1) flip, to compose them into one pass.
+static int jxform_bits (JXFORM_CODE code)
+{
+  switch (code) {
+  case JXFORM_FLIP_H:     return 2;
+  case JXFORM_FLIP_V:     return 1;
+  case JXFORM_ROT_180:    return 3;
+  case JXFORM_TRANSPOSE:  return 4;
+  case JXFORM_ROT_90:     return 6;
+  case JXFORM_ROT_270:    return 5;
+  case JXFORM_TRANSVERSE: return 7;
+  default:                return 0;
+  }
+}
+
+// code applied after first
+static JXFORM_CODE jxform_compose (JXFORM_CODE first, JXFORM_CODE code)
+{
+  static const JXFORM_CODE codes[] = {
+    JXFORM_NONE, JXFORM_FLIP_V, JXFORM_FLIP_H, JXFORM_ROT_180,
+    JXFORM_TRANSPOSE, JXFORM_ROT_270, JXFORM_ROT_90, JXFORM_TRANSVERSE
+  };
+  
+  int a = jxform_bits (first);
+  const int b = jxform_bits (code);
+  if (b & 4) // a later transpose swaps the earlier flips
+    a = (a & 4) | ((a & 2) >> 1) | ((a & 1) << 1);
+  return codes[a ^ b];
+}
+
+bool JPEGCodec::transform (JXFORM_CODE code, Image& image)
+{
+  if (pending_halve && !transcode (image))
+    return false;
+  
+  // crops are specified in the transformed frame, so a transformation
+  // following one needs it applied first
+  if (pending_crop)
+    doTransform (image);
+  
+  jpeg_transform_info info;
+  const JXFORM_CODE previous = pending;
+  pending = jxform_compose (pending, code);
+  if (!planTransform (info)) {
+    pending = previous;
+    return false;
+  }
+  
+  setGeometry (image, info);
+  if (jxform_bits (code) & 4)
+    image.setResolution (image.resolutionY(), image.resolutionX());
+  return true;
+}
+
 bool JPEGCodec::flipX (Image& image)
 {
-  return doTransform (JXFORM_FLIP_H, image);
+  return transform (JXFORM_FLIP_H, image);
 }
 
 bool JPEGCodec::flipY (Image& image)
 {
-  return doTransform (JXFORM_FLIP_V, image);
+  return transform (JXFORM_FLIP_V, image);
 }
 
 bool JPEGCodec::rotate (Image& image, double angle)
 {
   // so rotate if the first fraction is zero
   switch ((int)(angle * 10)) {
-  case 900:  return doTransform (JXFORM_ROT_90, image);
-  case 1800: return doTransform (JXFORM_ROT_180, image);
-  case 2700: return doTransform (JXFORM_ROT_270, image);
+  case 900:  return transform (JXFORM_ROT_90, image);
+  case 1800: return transform (JXFORM_ROT_180, image);
+  case 2700: return transform (JXFORM_ROT_270, image);
   default:
     ; // no acceleration, fall thru
   }
@@ -827,13 +966,35 @@ bool JPEGCodec::rotate (Image& image, double angle)
 
 bool JPEGCodec::crop (Image& image, unsigned int x, unsigned int y, unsigned int w, unsigned int h)
 {
-  doTransform (JXFORM_NONE, image, 0 /* stream */, false /* to gray */, true /* crop */,
-	       x, y, w, h);
+  if (pending_halve && !transcode (image))
+    return false;
+  
+  const bool previous = pending_crop;
+  const unsigned int px = crop_x, py = crop_y, pw = crop_w, ph = crop_h;
   
-  // reminder of 8x8 JPEG block crop
-  x %= 8;
-  y %= 8;
-  if (x || y) {
+  // a crop of a crop is relative to the iMCU aligned origin of the first
+  if (pending_crop) {
+    x += crop_x - crop_x % mcu_w;
+    y += crop_y - crop_y % mcu_h;
+  }
+  
+  jpeg_transform_info info;
+  pending_crop = true;
+  crop_x = x; crop_y = y;
+  crop_w = w; crop_h = h;
+  if (!planTransform (info)) {
+    pending_crop = previous;
+    crop_x = px; crop_y = py;
+    crop_w = pw; crop_h = ph;
+    return false;
+  }
+  
+  setGeometry (image, info);
+  
+  // reminder of the iMCU aligned JPEG block crop
+  x %= mcu_w;
+  y %= mcu_h;
+  if ((x || y) && !mcu_crop) {
     // invalidate, otherwise the ::crop() does call us again
     image.setRawData();
     // global crop, not our method
@@ -844,8 +1005,30 @@ bool JPEGCodec::crop (Image& image, unsigned int x, unsigned int y, unsigned int
 }
 
 bool JPEGCodec::toGray (Image& image)
-{ 
-  return doTransform (JXFORM_NONE, image, 0 /* stream */, true /* to gray */);
+{
+  if (pending_halve && !transcode (image))
+    return false;
+  
+  jpeg_transform_info info;
+  const bool previous = pending_gray;
+  pending_gray = true;
+  // only YCbCr can drop the chroma, let the generic code handle the rest
+  if (!planTransform (info) || info.num_components != 1) {
+    pending_gray = previous;
+    return false;
+  }
+  
+  // the smaller gray iMCU might align a pending crop differently
+  if (info.output_width != (JDIMENSION)image.w ||
+      info.output_height != (JDIMENSION)image.h) {
+    pending_gray = previous;
+    doTransform (image);
+    pending_gray = true;
+    planTransform (info);
+  }
+  
+  setGeometry (image, info);
+  return true;
 }
 
 bool JPEGCodec::scale (Image& image, double xscale, double yscale, bool fixed)
@@ -854,14 +1037,30 @@ bool JPEGCodec::scale (Image& image, double xscale, double yscale, bool fixed)
   if (xscale > 1.0 || yscale > 1.0 || fixed)
     return false; // let the generic scaler handle this
   
+  // exact power of two down-scaling is kept pending: the private copy's
+  // coefficients are merged when written, or decoded with a scaled IDCT
+  for (int n = 1; xscale == yscale && n <= 3 - pending_halve; ++n)
+    if (xscale * (1 << n) == 1.0) {
+      if (pendingTransform())
+	doTransform (image);
+      pending_halve += n;
+      image.w = (image.w + (1 << n) - 1) >> n;
+      image.h = (image.h + (1 << n) - 1) >> n;
+      image.setResolution (image.resolutionX() >> n, image.resolutionY() >> n);
+      
+      image.setRawData(0);
+      image.setCodec(this);
+      return true;
+    }
+  
   int w_final = (int)(xscale * image.w);
   int h_final = (int)(xscale * image.h);
 
   std::cerr << "Scaling by partially loading DCT coefficients." << std::endl;
     
-  // compute downscale factor
+  // compute downscale factor, pending halving included by decodeNow
   int scale = (int) (xscale > yscale ? 1./xscale : 1./yscale);
-  if      (scale > 8) scale = 8;
+  if      (scale > (8 >> pending_halve)) scale = 8 >> pending_halve;
   else if (scale < 1) scale = 1;
   
   // we get values in the range [1,8] here, but libjpeg only
@@ -947,12 +1146,141 @@ bool JPEGCodec::readMeta (std::istream* stream, Image& image)
   return true;
 }
 
-bool JPEGCodec::doTransform (JXFORM_CODE code, Image& image,
-			     std::ostream* s, bool to_gray, bool crop,
-			     unsigned int x, unsigned int y,
-			     unsigned int w, unsigned int h)
+int JPEGCodec::probeImage (std::istream* stream, Image& image, int index)
+{
+  if (stream->peek() != 0xFF)
+    return false;
+  stream->get(); // consume silently
+  if (stream->peek() != 0xD8 || index > 0)
+    return false;
+  stream->seekg (0);
+  
+  struct jpeg_decompress_struct cinfo;
+  struct my_error_mgr jerr;
+  
+  cinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = my_error_exit;
+  if (setjmp(jerr.setjmp_buffer)) {
+    jpeg_destroy_decompress (&cinfo);
+    return false;
+  }
+  
+  jpeg_create_decompress (&cinfo);
+  cpp_stream_src (&cinfo, stream);
+  jpeg_save_markers (&cinfo, JPEG_APP0 + 1, 0xffff); // Exif
+  
+  // unlike readMeta, stop at the first scan, no coefficient is decoded
+  jpeg_read_header(&cinfo, (boolean)TRUE);
+  jpeg_calc_output_dimensions(&cinfo);
+  
+  image.w = cinfo.output_width;
+  image.h = cinfo.output_height;
+  image.spp = cinfo.output_components;
+  image.bps = 8;
+  
+  switch (cinfo.density_unit)
+    {
+    case 1: // dots/inch
+      image.setResolution(cinfo.X_density, cinfo.Y_density);
+      break;
+    case 2: // dots/cm
+      image.setResolution(cinfo.X_density * 254 / 100,
+			  cinfo.Y_density * 254 / 100);
+      break;
+    default:
+      image.setResolution(0, 0);
+    }
+  
+  // the Exif resolution fallback and orientation, as applied by readImage
+  for (jpeg_saved_marker_ptr m = cinfo.marker_list; m; m = m->next)
+    if (m->marker == JPEG_APP0 + 1 && m->data_length >= 6 &&
+	memcmp (m->data, "Exif\0\0", 6) == 0) {
+      uint16_t orientation;
+      uint32_t xres, yres;
+      parseExifTIFF (m->data + 6, m->data_length - 6, orientation, xres, yres);
+      
+      if ((xres || yres) &&
+	  image.resolutionX() == 0 && image.resolutionY() == 0)
+	image.setResolution(xres, yres);
+      if (orientation >= 5 && orientation <= 8) { // transposed
+	std::swap (image.w, image.h);
+	image.setResolution(image.resolutionY(), image.resolutionX());
+      }
+      break;
+    }
+  
+  image.setCompression(cinfo.progressive_mode ? "jpeg-progressive" : "jpeg");
+  
+  jpeg_destroy_decompress(&cinfo);
+  return true;
+}
+
+void JPEGCodec::setupTransform (jpeg_transform_info& info)
+{
+  info = jpeg_transform_info();
+  
+  info.transform = pending;
+  info.trim = (boolean)TRUE;
+  info.perfect = (boolean)FALSE;
+  info.force_grayscale = (boolean)(pending_gray ? TRUE : FALSE);
+  
+  info.crop = (boolean)(pending_crop ? TRUE : FALSE);
+  if (pending_crop) {
+    info.crop_xoffset = crop_x;
+    info.crop_xoffset_set = JCROP_POS;
+    info.crop_yoffset = crop_y;
+    info.crop_yoffset_set = JCROP_POS;
+    info.crop_width = crop_w;
+    info.crop_width_set = JCROP_POS;
+    info.crop_height = crop_h;
+    info.crop_height_set = JCROP_POS;
+  }
+}
+
+// Only parses the header to compute the geometry the pending operations
+// will result in, without reading any coefficient.
+bool JPEGCodec::planTransform (jpeg_transform_info& info)
+{
+  jpeg_decompress_struct srcinfo;
+  struct my_error_mgr jerr;
+  
+  srcinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = my_error_exit;
+  if (setjmp(jerr.setjmp_buffer)) {
+    // e.g. a crop outside the image
+    jpeg_destroy_decompress (&srcinfo);
+    return false;
+  }
+  
+  jpeg_create_decompress (&srcinfo);
+  private_copy.seekg (0);
+  cpp_stream_src (&srcinfo, &private_copy);
+  jpeg_read_header(&srcinfo, (boolean)TRUE);
+  
+  setupTransform (info);
+  jtransform_request_workspace(&srcinfo, &info);
+  
+  jpeg_destroy_decompress (&srcinfo);
+  return true;
+}
+
+void JPEGCodec::setGeometry (Image& image, const jpeg_transform_info& info)
+{
+  image.w = info.output_width;
+  image.h = info.output_height;
+  image.spp = info.num_components;
+  mcu_w = info.iMCU_sample_width;
+  mcu_h = info.iMCU_sample_height;
+  
+  // decoded data, if any, is stale, and decoded again on access
+  image.setRawData(0);
+  image.setCodec(this);
+}
+
+bool JPEGCodec::doTransform (Image& image, std::ostream* s,
+			     const jpeg_coding* coding)
 {
-  jpeg_transform_info transformoption = {}; // image transformation options
+  jpeg_transform_info transformoption; // image transformation options
   
   jpeg_decompress_struct srcinfo;
   jpeg_compress_struct dstinfo;
@@ -979,22 +1307,8 @@ bool JPEGCodec::doTransform (JXFORM_CODE code, Image& image,
   // Read file header
   jpeg_read_header(&srcinfo, (boolean)TRUE);
   
-  transformoption.transform = code;
-  transformoption.trim = (boolean)TRUE;
-  transformoption.perfect = (boolean)FALSE;
-  transformoption.force_grayscale = (boolean)(to_gray ? TRUE : FALSE);
-  
-  transformoption.crop = (boolean)(crop ? TRUE : FALSE);
-  if (crop) {
-    transformoption.crop_xoffset = x;
-    transformoption.crop_xoffset_set = JCROP_POS;
-    transformoption.crop_yoffset = y;
-    transformoption.crop_yoffset_set = JCROP_POS;
-    transformoption.crop_width = w;
-    transformoption.crop_width_set = JCROP_POS;
-    transformoption.crop_height = h;
-    transformoption.crop_height_set = JCROP_POS;
-  }
+  // all pending operations in one pass
+  setupTransform (transformoption);
   
   // Any space needed by a transform option must be requested before
   // jpeg_read_coefficients so that memory allocation will be done right.
@@ -1024,6 +1338,7 @@ bool JPEGCodec::doTransform (JXFORM_CODE code, Image& image,
   cpp_stream_dest (&dstinfo, s ? s : &stream);
   
   jpeg_compress_set_density (&dstinfo, image);
+  jpeg_compress_set_coding (&dstinfo, coding, srcinfo.progressive_mode);
   
   // Start compressor (note no image data is actually written here)
   jpeg_write_coefficients(&dstinfo, dst_coef_arrays);
@@ -1043,39 +1358,202 @@ bool JPEGCodec::doTransform (JXFORM_CODE code, Image& image,
   if (!s) {
     // copy into the shadow buffer
     private_copy.str (stream.str());
-    
-    // if the data is accessed again, it must be re-encoded
-    image.setRawData(0);
-    image.setCodec(this);
+    pending = JXFORM_NONE;
+    pending_gray = pending_crop = false;
     
     // Update meta: w, h, spp might have changed.
-    image.w = transformoption.output_width;
-    image.h = transformoption.output_height;
-
-    // avoid the expensive readMeta for some cases
-    switch (code) {
-    case JXFORM_ROT_90:
-    case JXFORM_ROT_270:
-	image.setResolution(image.resolutionX(), image.resolutionY());
-	image.setCodec(this);
-
-    case JXFORM_ROT_180:
-    case JXFORM_FLIP_H:
-    case JXFORM_FLIP_V:
-      
-    default:
-      ; // silence compiler
-    }
+    setGeometry (image, transformoption);
+  }
+  
+  return true;
+}
+
+// Orthonormal DCT-II basis of size n, JPEG's 8x8 FDCT is the 2D one
+static double dct_basis (int n, int k, int x)
+{
+  return sqrt((k ? 2.0 : 1.0) / n) * cos((2 * x + 1) * k * M_PI / (2 * n));
+}
+
+// Rewrites the DCT coefficients without decoding: halving the resolution
+// pending_halve times, by merging the low frequencies of each 2^n x 2^n
+// block group into one block, and requantizing to the tables of the
+// given quality, if any; when not downscaling never finer than the
+// source ones, as that would only grow the file.
+bool JPEGCodec::transcode (Image& image, std::ostream* s, int quality,
+			   const jpeg_coding* coding)
+{
+  jpeg_decompress_struct srcinfo;
+  jpeg_compress_struct dstinfo;
+  struct my_error_mgr jerr;
+  
+  // declared before the setjmp, so the error return does not skip
+  // their destruction
+  std::vector<double> a;
+  std::vector<jvirt_barray_ptr> dst_coef_arrays;
+  std::vector<JDIMENSION> dst_w, dst_h;
+  std::vector<JCOEF> rows; // of JBLOCKs
+  std::stringstream stream;
+  
+  // zeroed, so destroying a not yet created object is a no-op
+  memset (&srcinfo, 0, sizeof(srcinfo));
+  memset (&dstinfo, 0, sizeof(dstinfo));
+  
+  // one error manager for both, overriding error_exit
+  srcinfo.err = dstinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = my_error_exit;
+  if (setjmp(jerr.setjmp_buffer)) {
+    jpeg_destroy_compress(&dstinfo);
+    jpeg_destroy_decompress(&srcinfo);
+    return false;
+  }
+  
+  jpeg_create_decompress(&srcinfo);
+  jpeg_create_compress(&dstinfo);
+  
+  srcinfo.mem->max_memory_to_use = dstinfo.mem->max_memory_to_use;
+  
+  private_copy.seekg (0);
+  cpp_stream_src (&srcinfo, &private_copy);
+  jpeg_read_header(&srcinfo, (boolean)TRUE);
+  
+  jvirt_barray_ptr* src_coef_arrays = jpeg_read_coefficients(&srcinfo);
+  jpeg_copy_critical_parameters(&srcinfo, &dstinfo);
+  
+  const int f = 1 << pending_halve, n = DCTSIZE / f;
+  dstinfo.image_width = (srcinfo.image_width + f - 1) / f;
+  dstinfo.image_height = (srcinfo.image_height + f - 1) / f;
+  
+  if (quality > 0) {
+    jpeg_set_quality(&dstinfo, quality, (boolean)FALSE);
+    for (int i = 0; f == 1 && i < NUM_QUANT_TBLS; ++i)
+      if (srcinfo.quant_tbl_ptrs[i] && dstinfo.quant_tbl_ptrs[i])
+	for (int k = 0; k < DCTSIZE2; ++k)
+	  dstinfo.quant_tbl_ptrs[i]->quantval[k] =
+	    std::max(dstinfo.quant_tbl_ptrs[i]->quantval[k],
+		     srcinfo.quant_tbl_ptrs[i]->quantval[k]);
+  }
+  
+  // a[h][u][k]: contribution of frequency k of the h-th source block to
+  // the output frequency u, in one dimension
+  a.resize (f * DCTSIZE * n);
+  for (int h = 0; h < f; ++h)
+    for (int u = 0; u < DCTSIZE; ++u)
+      for (int k = 0; k < n; ++k) {
+	double sum = 0;
+	for (int x = 0; x < n; ++x)
+	  sum += dct_basis(DCTSIZE, u, h * n + x) * dct_basis(n, k, x);
+	a[(h * DCTSIZE + u) * n + k] = sum / sqrt((double)f);
+      }
+  
+  // output arrays, padded to whole iMCUs as the compressor expects
+  dst_coef_arrays.resize (dstinfo.num_components);
+  dst_w.resize (dstinfo.num_components);
+  dst_h.resize (dstinfo.num_components);
+  for (int ci = 0; ci < dstinfo.num_components; ++ci) {
+    jpeg_component_info* compptr = dstinfo.comp_info + ci;
+    const int mh = srcinfo.max_h_samp_factor * DCTSIZE, mv = srcinfo.max_v_samp_factor * DCTSIZE;
+    JDIMENSION bw = (dstinfo.image_width * compptr->h_samp_factor + mh - 1) / mh;
+    JDIMENSION bh = (dstinfo.image_height * compptr->v_samp_factor + mv - 1) / mv;
+    dst_w[ci] = (bw + compptr->h_samp_factor - 1) / compptr->h_samp_factor * compptr->h_samp_factor;
+    dst_h[ci] = (bh + compptr->v_samp_factor - 1) / compptr->v_samp_factor * compptr->v_samp_factor;
+    dst_coef_arrays[ci] = (*dstinfo.mem->request_virt_barray)
+      ((j_common_ptr)&dstinfo, JPOOL_IMAGE, FALSE, dst_w[ci], dst_h[ci],
+       compptr->v_samp_factor);
+  }
+  
+  if (!s)
+    stream.str().reserve(private_copy.str().size());
+  cpp_stream_dest (&dstinfo, s ? s : &stream);
+  jpeg_compress_set_density (&dstinfo, image);
+  jpeg_compress_set_coding (&dstinfo, coding, srcinfo.progressive_mode);
+  
+  // realizes the output arrays
+  jpeg_write_coefficients(&dstinfo, &dst_coef_arrays[0]);
+  
+  for (int ci = 0; ci < dstinfo.num_components; ++ci) {
+    jpeg_component_info* compptr = srcinfo.comp_info + ci;
+    const JQUANT_TBL* qs = compptr->quant_table ? compptr->quant_table :
+      srcinfo.quant_tbl_ptrs[compptr->quant_tbl_no];
+    const JQUANT_TBL* qd = dstinfo.quant_tbl_ptrs[dstinfo.comp_info[ci].quant_tbl_no];
+    const JDIMENSION src_w = (compptr->width_in_blocks + compptr->h_samp_factor - 1) /
+      compptr->h_samp_factor * compptr->h_samp_factor;
+    const JDIMENSION src_h = (compptr->height_in_blocks + compptr->v_samp_factor - 1) /
+      compptr->v_samp_factor * compptr->v_samp_factor;
+    
+    int64_t ratio[DCTSIZE2]; // 16.16 fixed point
+    for (int k = 0; k < DCTSIZE2; ++k)
+      ratio[k] = ((int64_t)qs->quantval[k] << 16) / qd->quantval[k];
     
-    if (to_gray) {
-      image.spp = 1;
+    // the f source block rows, copied as access may swap to backing store
+    rows.resize (f * src_w * DCTSIZE2);
+    for (JDIMENSION by = 0; by < dst_h[ci]; ++by) {
+      for (int hy = 0; hy < f; ++hy) {
+	const JDIMENSION sy = std::min (by * f + hy, src_h - 1);
+	JBLOCKARRAY row = (*srcinfo.mem->access_virt_barray)
+	  ((j_common_ptr)&srcinfo, src_coef_arrays[ci], sy, 1, FALSE);
+	memcpy (&rows[hy * src_w * DCTSIZE2], row[0], src_w * sizeof(JBLOCK));
+      }
+      
+      JBLOCKARRAY drow = (*dstinfo.mem->access_virt_barray)
+	((j_common_ptr)&dstinfo, dst_coef_arrays[ci], by, 1, TRUE);
+      
+      // just requantize, most coefficients are zero
+      if (f == 1) {
+	for (JDIMENSION bx = 0; bx < dst_w[ci]; ++bx)
+	  for (int k = 0; k < DCTSIZE2; ++k) {
+	    const int64_t v = rows[bx * DCTSIZE2 + k] * ratio[k];
+	    drow[0][bx][k] = (JCOEF)((v + (v >= 0 ? 0x8000 : 0x7fff)) >> 16);
+	  }
+	continue;
+      }
+      
+      for (JDIMENSION bx = 0; bx < dst_w[ci]; ++bx) {
+	double out[DCTSIZE2] = {};
+	for (int hy = 0; hy < f; ++hy)
+	  for (int hx = 0; hx < f; ++hx) {
+	    const JDIMENSION sx = std::min (bx * f + hx, src_w - 1);
+	    const JCOEF* c = &rows[(hy * src_w + sx) * DCTSIZE2];
+	    // separable, skipping the mostly zero coefficients
+	    double tmp[DCTSIZE * DCTSIZE]; // [l][u]
+	    for (int l = 0; l < n; ++l) {
+	      bool nonzero = false;
+	      for (int u = 0; u < DCTSIZE; ++u)
+		tmp[l * DCTSIZE + u] = 0;
+	      for (int k = 0; k < n; ++k) {
+		if (!c[l * DCTSIZE + k])
+		  continue;
+		const double v = c[l * DCTSIZE + k] * qs->quantval[l * DCTSIZE + k];
+		for (int u = 0; u < DCTSIZE; ++u)
+		  tmp[l * DCTSIZE + u] += a[(hx * DCTSIZE + u) * n + k] * v;
+		nonzero = true;
+	      }
+	      if (!nonzero)
+		continue;
+	      for (int v = 0; v < DCTSIZE; ++v)
+		for (int u = 0; u < DCTSIZE; ++u)
+		  out[v * DCTSIZE + u] += a[(hy * DCTSIZE + v) * n + l] * tmp[l * DCTSIZE + u];
+	    }
+	  }
+	
+	JCOEF* d = drow[0][bx];
+	for (int k = 0; k < DCTSIZE2; ++k)
+	  d[k] = (JCOEF) floor(out[k] / qd->quantval[k] + 0.5);
+      }
     }
+  }
+  
+  jpeg_finish_compress(&dstinfo);
+  jpeg_destroy_compress(&dstinfo);
+  jpeg_finish_decompress(&srcinfo);
+  jpeg_destroy_decompress(&srcinfo);
+  
+  if (!s) {
+    private_copy.str (stream.str());
+    pending_halve = 0;
     
-    // We re-read the header because we do not want to re-hardcode the
-    // trimming required for all the other corner cases.
-    //std::cerr << "Re-reading meta data." << std::endl;
-    //readMeta (&private_copy, image);
-    //image.setCodec(this);
+    // if the data is accessed again, it must be decoded again
+    image.setRawData(0);
+    image.setCodec(this);
   }
   
   return true;
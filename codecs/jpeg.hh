@@ -26,10 +26,15 @@ extern "C" {
 
 #include "Codecs.hh"
 
+struct jpeg_coding; // entropy coding options
+
 class JPEGCodec : public ImageCodec {
 public:
   
-  JPEGCodec () {
+  JPEGCodec ()
+    : colorspace(JCS_UNKNOWN), pending(JXFORM_NONE), pending_gray(false),
+      pending_crop(false), mcu_w(8), mcu_h(8), mcu_crop(false),
+      pending_halve(0) {
     registerCodec ("jpeg", this);
     registerCodec ("jpg", this);
   };
@@ -40,6 +45,7 @@ public:
   virtual std::string getID () { return "JPEG"; };
   
   virtual int readImage (std::istream* stream, Image& image, const std::string& decompres);
+  virtual int probeImage (std::istream* stream, Image& image, int index);
   virtual bool writeImage (std::ostream* stream, Image& image,
 			   int quality, const std::string& compress);
   
@@ -61,10 +67,27 @@ private:
   
   // internals and helper
   bool readMeta (std::istream* stream, Image& image);
-  bool doTransform (JXFORM_CODE code, Image& image,
-		    std::ostream* stream = 0, bool to_gray = false, bool crop = false,
-		    unsigned int x = 0, unsigned int y = 0, unsigned int w = 0, unsigned int h = 0);
+  bool transform (JXFORM_CODE code, Image& image);
+  void setupTransform (jpeg_transform_info& info);
+  bool planTransform (jpeg_transform_info& info);
+  void setGeometry (Image& image, const jpeg_transform_info& info);
+  bool doTransform (Image& image, std::ostream* stream = 0,
+		    const jpeg_coding* coding = 0);
+  bool transcode (Image& image, std::ostream* stream = 0, int quality = 0,
+		  const jpeg_coding* coding = 0);
+  bool pendingTransform () {
+    return pending != JXFORM_NONE || pending_gray || pending_crop;
+  }
   
   int colorspace; // maybe just store the decompress string?
   std::stringstream private_copy;
+  
+  // lossless operations not yet applied to the private copy, composed
+  // to be executed in one pass over the DCT coefficients
+  JXFORM_CODE pending;
+  bool pending_gray, pending_crop;
+  unsigned int crop_x, crop_y, crop_w, crop_h;
+  unsigned int mcu_w, mcu_h; // iMCU size of the pending result
+  bool mcu_crop; // keep crops iMCU aligned, no pixel-exact remainder
+  int pending_halve; // resolution halvings, applied by transcode
 };
@@ -209,6 +209,72 @@ int PNGCodec::readImage (std::istream* stream, Image& image, const std::string&
   return true;
 }
 
+int PNGCodec::probeImage (std::istream* stream, Image& image, int index)
+{
+  { // quick magic check
+    char buf [4];
+    stream->read (buf, sizeof (buf));
+    int cmp = png_sig_cmp ((png_byte*)buf, (png_size_t)0, sizeof (buf));
+    stream->seekg (0);
+    if (cmp != 0)
+      return false;
+  }
+  
+  if (index > 0)
+    return false;
+  
+  png_structp png_ptr;
+  png_infop info_ptr;
+  png_uint_32 width, height;
+  int bit_depth, color_type, num_trans;
+  
+  png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  if (png_ptr == NULL)
+    return 0;
+  
+  info_ptr = png_create_info_struct(png_ptr);
+  if (info_ptr == NULL) {
+    png_destroy_read_struct(&png_ptr, NULL, NULL);
+    return 0;
+  }
+  
+  if (setjmp(png_jmpbuf(png_ptr))) {
+    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+    return 0;
+  }
+  
+  png_set_read_fn (png_ptr, stream, &stdstream_read_data);
+  
+  // all the chunks up to the first IDAT, the pixel data is not touched
+  png_read_info (png_ptr, info_ptr);
+  
+  png_get_IHDR (png_ptr, info_ptr, &width, &height, &bit_depth, &color_type,
+		NULL, NULL, NULL);
+  
+  image.w = width;
+  image.h = height;
+  image.bps = bit_depth;
+  image.spp = png_get_channels(png_ptr, info_ptr);
+  
+  png_uint_32 res_x, res_y;
+  res_x = png_get_x_pixels_per_meter(png_ptr, info_ptr);
+  res_y = png_get_y_pixels_per_meter(png_ptr, info_ptr);
+  image.setResolution((2.54 * res_x + .5) / 100, (2.54 * res_y + .5) / 100);
+  
+  // palette images are expanded to RGB(A) by readImage
+  num_trans = 0;
+  png_get_tRNS(png_ptr, info_ptr, NULL, &num_trans, NULL);
+  if (color_type == PNG_COLOR_TYPE_PALETTE) {
+    image.bps = 8;
+    image.spp = num_trans ? 4 : 3;
+  }
+  
+  image.setCompression ("deflate");
+  
+  png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+  return true;
+}
+
 bool PNGCodec::writeImage (std::ostream* stream, Image& image, int quality,
 			   const std::string& compress)
 {
@@ -25,5 +25,6 @@ public:
   virtual std::string getID () { return "PNG"; };
   
   virtual int readImage (std::istream* stream, Image& image, const std::string& decompres);
+  virtual int probeImage (std::istream* stream, Image& image, int index);
   virtual bool writeImage (std::ostream* stream, Image& image, int quality, const std::string& compress);
 };
@@ -29,10 +29,8 @@
 #include <iostream>
 #include <string>
 #include <sstream>
-
-#ifdef _MSC_VER
 #include <vector>
-#endif
+#include <algorithm>
 
 #include "pnm.hh"
 #include "Endianess.hh"
@@ -66,11 +64,12 @@ int getNextHeaderNumber (std::istream* stream)
   return i;
 }
 
-int PNMCodec::readImage (std::istream* stream, Image& image, const std::string& decompres)
+// parses the header up to the pixel data, returns the mode or 0
+static char readHeader (std::istream* stream, Image& image, int& maxval)
 {
   // check signature
   if (stream->peek () != 'P')
-    return false;
+    return 0;
   stream->get(); // consume P
   
   image.bps = 0;
@@ -89,14 +88,14 @@ int PNMCodec::readImage (std::istream* stream, Image& image, const std::string&
     break;
   default:
     stream->unget(); // P
-    return false;
+    return 0;
   }
   stream->get(); // consume format number
   
   image.w = getNextHeaderNumber (stream);
   image.h = getNextHeaderNumber (stream);
   
-  int maxval = 1;
+  maxval = 1;
   if (image.bps != 1) {
     maxval = getNextHeaderNumber (stream);
   }
@@ -108,6 +107,58 @@ int PNMCodec::readImage (std::istream* stream, Image& image, const std::string&
   // not stored in the format :-(
   image.setResolution(0, 0);
   
+  return mode;
+}
+
+/* The plain (ASCII) formats are parsed by hand, operator>> and its
+   locale and sentry overhead per sample are way too slow. Returns -1 on
+   the end of the stream or garbage. */
+
+static inline int readPlainNumber (std::streambuf* sb, bool single_digit)
+{
+  const int eof = std::char_traits<char>::eof();
+  int c = sb->sbumpc();
+  for (;; c = sb->sbumpc()) {
+    if (c == '#') // comment till the end of line
+      while (c != '\n' && c != '\r' && c != eof)
+	c = sb->sbumpc();
+    if (c != ' ' && c != '\n' && c != '\r' && c != '\t' && c != '\v' && c != '\f')
+      break;
+  }
+  
+  if (c < '0' || c > '9')
+    return -1;
+  
+  // plain PBM does not require whitespace between the single digits
+  int i = c - '0';
+  if (!single_digit)
+    for (c = sb->sgetc(); c >= '0' && c <= '9'; c = sb->snextc())
+      i = i * 10 + (c - '0');
+  return i;
+}
+
+// 16-bit PNM is big-endian, a tight loop over the whole block vectorizes
+static void swap16 (uint8_t* data, size_t bytes)
+{
+  uint16_t* swap_ptr = (uint16_t*)data;
+  for (size_t i = 0; i < bytes / 2; ++i)
+    swap_ptr[i] = ByteSwap<NativeEndianTraits,BigEndianTraits, uint16_t>::Swap (swap_ptr[i]);
+}
+
+// is it publically defined somewhere??? PBM has 1 == black
+static void invert (uint8_t* data, size_t bytes)
+{
+  for (size_t i = 0; i < bytes; ++i)
+    data[i] ^= 0xff;
+}
+
+int PNMCodec::readImage (std::istream* stream, Image& image, const std::string& decompres)
+{
+  int maxval;
+  char mode = readHeader (stream, image, maxval);
+  if (!mode)
+    return false;
+  
   // allocate data, if necessary
   image.resize (image.w, image.h);
   
@@ -117,64 +168,80 @@ int PNMCodec::readImage (std::istream* stream, Image& image, const std::string&
     std::getline (*stream, str);
   }
   
+  const int stride = image.stride();
+  const int bps = image.bps;
+  uint8_t* data = image.getRawData();
+  
   if (mode <= '3') // ascii / plain text
     {
-      Image::iterator it = image.begin ();
+      std::streambuf* sb = stream->rdbuf();
+      const int samples = image.w * image.spp;
+      const int max = (1 << bps) - 1;
+      
       for (int y = 0; y < image.h; ++y)
 	{
-	  for (int x = 0; x < image.w; ++x)
+	  uint8_t* dest = data + y * stride;
+	  uint16_t* dest16 = (uint16_t*)dest;
+	  unsigned bits = 0, nbits = 0;
+	  
+	  for (int x = 0; x < samples; ++x)
 	    {
-	      if (image.spp == 1) {
-		int i;
-		*stream >> i;
-		
-		i = i * (255 / maxval);
-
-		// only mode 1 is defined with 1 == black, ...
-		if (mode == '1') i = 255 - i;
-
-		it.setL (i);
+	      int i = readPlainNumber (sb, mode == '1');
+	      if (i < 0) {
+		std::cerr << "PNMCodec: premature end of data" << std::endl;
+		return false;
 	      }
+	      
+	      // only mode 1 is defined with 1 == black, ...
+	      if (mode == '1')
+		i = !i;
+	      else if (maxval != max)
+		i = (unsigned)i * max / maxval;
+	      
+	      if (bps == 16)
+		*dest16++ = i;
+	      else if (bps == 8)
+		*dest++ = i;
 	      else {
-		uint16_t r, g, b;
-		*stream >> r >> g >> b;
-		
-		it.setRGB (r, g, b);
+		bits = bits << bps | i;
+		for (nbits += bps; nbits >= 8; nbits -= 8)
+		  *dest++ = bits >> (nbits - 8);
 	      }
-	      
-	      it.set (it);
-	      ++it;
 	    }
+	  
+	  if (nbits)
+	    *dest = bits << (8 - nbits);
 	}
     }
   else // binary data
     {
-      const int stride = image.stride();
-      const int bps = image.bps;
+      // rows are not padded in the file, thus read all in one go
+      if ((unsigned)stride == image.stridefill())
+	stream->read ((char*)data, stride * image.h);
+      else
+	for (int y = 0; y < image.h; ++y)
+	  stream->read ((char*)data + y * stride, image.stridefill());
       
-      for (int y = 0; y < image.h; ++y)
-	{
-	  uint8_t* dest = image.getRawData() + y * stride;
-	  stream->read ((char*)dest, stride);
-
-	  // is it publically defined somewhere???
-	  if (bps == 1) {
-	    uint8_t* xor_ptr = dest;
-	    for (int x = 0; x < image.w; x += 8)
-	      *xor_ptr++ ^= 0xff;
-	  }
-	  
-	  if (bps == 16) {
-	    uint16_t* swap_ptr = (uint16_t*)dest;
-	    for (int x = 0; x < stride/2; ++x, ++swap_ptr)
-	      *swap_ptr = ByteSwap<NativeEndianTraits,BigEndianTraits, uint16_t>::Swap (*swap_ptr);
-	  }
-	}
+      if (bps == 1)
+	invert (data, stride * image.h);
+      else if (bps == 16)
+	swap16 (data, stride * image.h);
     }
   
   return true;
 }
 
+int PNMCodec::probeImage (std::istream* stream, Image& image, int index)
+{
+  int maxval;
+  char mode = readHeader (stream, image, maxval);
+  if (!mode || index > 0)
+    return false;
+  
+  image.setCompression (mode <= '3' ? "ascii" : "none");
+  return true;
+}
+
 bool PNMCodec::writeImage (std::ostream* stream, Image& image, int quality,
 			   const std::string& compress)
 {
@@ -209,69 +276,90 @@ bool PNMCodec::writeImage (std::ostream* stream, Image& image, int quality,
   
   // maxval
   const int maxval = (1 << image.bps) - 1;
-  const int divval = image.bps < 8 ? 255 / maxval : 1;
   
   if (image.bps > 1)
     *stream << maxval << std::endl;
   
-  Image::iterator it = image.begin ();
+  const int bps = image.bps;
+  const int stride = image.stride();
+  const int stridefill = image.stridefill();
+  const uint8_t* data = image.getRawData();
+  
   if (c == "ascii")
     {
+      // formatted by hand into a line buffer, wrapped at 70 characters
+      const int samples = image.w * image.spp;
+      const unsigned mask = (1 << bps) - 1;
+      char line[80];
+      int len = 0;
+      
       for (int y = 0; y < image.h; ++y)
 	{
-	  it = it.at(0, y);
-	  for (int x = 0; x < image.w; ++x, ++it)
+	  const uint8_t* src = data + y * stride;
+	  
+	  for (int x = 0; x < samples; ++x)
 	    {
-	      if (x != 0)
-		*stream << " ";
-	      
-	      *it;
-	      if (image.spp == 1) {
-		unsigned i = it.getL();
-
-		// only mode 1 is defined with 1 == black, ...
-		if (format == 1) i = 255 - i;
-		*stream << i / divval;
-	      }
+	      unsigned i;
+	      if (bps == 16)
+		i = ((const uint16_t*)src)[x];
+	      else if (bps == 8)
+		i = src[x];
 	      else {
-		uint16_t r = 0, g = 0, b = 0;
-		it.getRGB (&r, &g, &b);
-		*stream << (int)r << " " << (int)g << " " << (int)b;
+		const unsigned bit = x * bps;
+		i = (src[bit / 8] >> (8 - bps - bit % 8)) & mask;
+	      }
+	      
+	      // only mode 1 is defined with 1 == black, ...
+	      if (format == 1)
+		i = !i;
+	      
+	      char digits[8];
+	      int n = 0;
+	      do {
+		digits[n++] = '0' + i % 10;
+		i /= 10;
+	      } while (i);
+	      
+	      if (len + n + 1 > 70) {
+		line[len++] = '\n';
+		stream->write (line, len);
+		len = 0;
 	      }
+	      else if (len)
+		line[len++] = ' ';
+	      
+	      while (n)
+		line[len++] = digits[--n];
 	    }
-	  *stream << std::endl;
+	  
+	  line[len++] = '\n';
+	  stream->write (line, len);
+	  len = 0;
 	}
     }
-  else
+  else if ((bps == 1 || bps == 16) ||
+	   stride != stridefill)
     {
-      const int bps = image.bps;
-      const int stride = image.stride();
-      const int stridefill = image.stridefill();
-#ifndef _MSC_VER
-      uint8_t ptr[stridefill];
-#else
-      std::vector<uint8_t> ptr(stridefill);
-#endif
-      for (int y = 0; y < image.h; ++y)
+      // swapped or inverted in blocks of rows, written in one go each
+      const int rows = std::max (1, (1 << 16) / stridefill);
+      std::vector<uint8_t> block (rows * stridefill);
+      
+      for (int y = 0; y < image.h; y += rows)
 	{
-	  memcpy (&ptr[0], image.getRawData() + y * stride, stridefill);
-	  
-	  // is this publically defined somewhere???
-	  if (bps == 1) {
-	    uint8_t* xor_ptr = &ptr[0];
-	    for (int x = 0; x < image.w; x += 8)
-	      *xor_ptr++ ^= 0xff;
-	  }
+	  const int n = std::min (rows, image.h - y);
+	  for (int i = 0; i < n; ++i)
+	    memcpy (&block[i * stridefill], data + (y + i) * stride, stridefill);
 	  
-	  if (bps == 16) {
-	    uint16_t* swap_ptr = (uint16_t*)&ptr[0];
-	    for (int x = 0; x < stridefill / 2; ++x, ++swap_ptr)
-	      *swap_ptr = ByteSwap<BigEndianTraits, NativeEndianTraits, uint16_t>::Swap (*swap_ptr);
-	  }
+	  if (bps == 1)
+	    invert (&block[0], n * stridefill);
+	  else if (bps == 16)
+	    swap16 (&block[0], n * stridefill);
 	  
-	  stream->write((char*)&ptr[0], stridefill);
+	  stream->write ((char*)&block[0], n * stridefill);
 	}
     }
+  else
+    stream->write ((const char*)data, stride * image.h);
   
   return true;
 }
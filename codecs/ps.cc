@@ -17,13 +17,278 @@
  * copyright holder ExactCODE GmbH Germany.
  */
 
+#include <zlib.h>
+
 #include "ps.hh"
-#include "Encodings.hh"
 
 #if WITHLIBJPEG == 1
 #include "jpeg.hh"
 #endif
 
+#if WITHLIBTIFF == 1
+#include "tiff.hh"
+#endif
+
+/* The image data is fed row by row through a chain of encoders, each a
+   std::streambuf writing into the next stage's stream, so neither the
+   compressed nor the ASCII encoded data of the whole image is ever held
+   in memory. */
+
+class PSFilter : public std::streambuf
+{
+public:
+  PSFilter (std::ostream& _out)
+    : out (_out) {}
+  virtual ~PSFilter () {}
+  
+  virtual void write (const uint8_t* data, size_t n) = 0;
+  // flush pending data and write the end of data marker
+  virtual void finish () = 0;
+  
+protected:
+  virtual int overflow (int c)
+  {
+    if (c != EOF) {
+      uint8_t b = c;
+      write (&b, 1);
+    }
+    return 0;
+  }
+  
+  virtual std::streamsize xsputn (const char* s, std::streamsize n)
+  {
+    write ((const uint8_t*)s, n);
+    return n;
+  }
+  
+  std::ostream& out;
+};
+
+// ASCII85, encoded a whole group at a time into a larger output block
+class ASCII85Filter : public PSFilter
+{
+public:
+  ASCII85Filter (std::ostream& _out)
+    : PSFilter (_out), n (0), col (0), len (0) {}
+  
+  virtual void write (const uint8_t* data, size_t size)
+  {
+    // complete a partial group from the previous call
+    for (; n && size; --size)
+      {
+	tuple[n++] = *data++;
+	if (n == 4) {
+	  group ((uint32_t)tuple[0] << 24 | tuple[1] << 16 | tuple[2] << 8 | tuple[3]);
+	  n = 0;
+	}
+      }
+    
+    for (; size >= 4; size -= 4, data += 4)
+      group ((uint32_t)data[0] << 24 | data[1] << 16 | data[2] << 8 | data[3]);
+    
+    for (; size; --size)
+      tuple[n++] = *data++;
+  }
+  
+  virtual void finish ()
+  {
+    // the final partial group is zero padded and never abbreviated
+    if (n) {
+      for (int i = n; i < 4; ++i)
+	tuple[i] = 0;
+      uint32_t v = (uint32_t)tuple[0] << 24 | tuple[1] << 16 |
+	tuple[2] << 8 | tuple[3];
+      char c[5];
+      for (int i = 4; i >= 0; --i, v /= 85)
+	c[i] = '!' + v % 85;
+      for (int i = 0; i <= n; ++i)
+	buf[len++] = c[i];
+      n = 0;
+    }
+    flushBuffer ();
+    out << "~>";
+  }
+  
+private:
+  void group (uint32_t v)
+  {
+    if (col >= 75) {
+      buf[len++] = '\n';
+      col = 0;
+    }
+    if (v == 0) {
+      buf[len++] = 'z';
+      ++col;
+    }
+    else {
+      char* c = buf + len;
+      for (int i = 4; i >= 0; --i, v /= 85)
+	c[i] = '!' + v % 85;
+      len += 5;
+      col += 5;
+    }
+    if (len > (int)sizeof(buf) - 8)
+      flushBuffer ();
+  }
+  
+  void flushBuffer ()
+  {
+    out.write (buf, len);
+    len = 0;
+  }
+  
+  uint8_t tuple[4];
+  int n, col, len;
+  char buf[8192];
+};
+
+class HexFilter : public PSFilter
+{
+public:
+  HexFilter (std::ostream& _out)
+    : PSFilter (_out), col (0), len (0) {}
+  
+  virtual void write (const uint8_t* data, size_t size)
+  {
+    static const char hex[] = "0123456789abcdef";
+    for (; size; --size, ++data) {
+      buf[len++] = hex[*data >> 4];
+      buf[len++] = hex[*data & 0xf];
+      if (++col == 64) {
+	buf[len++] = '\n';
+	col = 0;
+      }
+      if (len > (int)sizeof(buf) - 4)
+	flushBuffer ();
+    }
+  }
+  
+  virtual void finish ()
+  {
+    flushBuffer ();
+    out << ">";
+  }
+  
+private:
+  void flushBuffer ()
+  {
+    out.write (buf, len);
+    len = 0;
+  }
+  
+  int col, len;
+  char buf[8192];
+};
+
+// PostScript RunLengthDecode, runs of three and more bytes are repeated
+class RunLengthFilter : public PSFilter
+{
+public:
+  RunLengthFilter (std::ostream& _out)
+    : PSFilter (_out), n (0), run (0) {}
+  
+  virtual void write (const uint8_t* data, size_t size)
+  {
+    for (; size; --size) {
+      const uint8_t b = *data++;
+      if (run) {
+	if (b == last && run < 128) {
+	  ++run;
+	  continue;
+	}
+	flushRun ();
+      }
+      
+      lit[n++] = b;
+      if (n >= 3 && lit[n-2] == b && lit[n-3] == b) {
+	n -= 3;
+	flushLiteral ();
+	last = b;
+	run = 3;
+      }
+      else if (n == 128)
+	flushLiteral ();
+    }
+  }
+  
+  virtual void finish ()
+  {
+    flushRun ();
+    flushLiteral ();
+    out.put ((char)128);
+  }
+  
+private:
+  void flushLiteral ()
+  {
+    if (n) {
+      out.put ((char)(n - 1));
+      out.write ((const char*)lit, n);
+      n = 0;
+    }
+  }
+  
+  void flushRun ()
+  {
+    if (run) {
+      out.put ((char)(257 - run));
+      out.put ((char)last);
+      run = 0;
+    }
+  }
+  
+  uint8_t lit[128];
+  int n, run;
+  uint8_t last;
+};
+
+class FlateFilter : public PSFilter
+{
+public:
+  FlateFilter (std::ostream& _out, int level = Z_DEFAULT_COMPRESSION)
+    : PSFilter (_out)
+  {
+    zs.zalloc = Z_NULL;
+    zs.zfree = Z_NULL;
+    zs.opaque = Z_NULL;
+    deflateInit (&zs, level);
+  }
+  
+  ~FlateFilter ()
+  {
+    deflateEnd (&zs);
+  }
+  
+  virtual void write (const uint8_t* data, size_t size)
+  {
+    zs.next_in = (Bytef*)data;
+    zs.avail_in = size;
+    deflateBuffer (Z_NO_FLUSH);
+  }
+  
+  virtual void finish ()
+  {
+    zs.next_in = Z_NULL;
+    zs.avail_in = 0;
+    deflateBuffer (Z_FINISH);
+  }
+  
+private:
+  void deflateBuffer (int flush)
+  {
+    int ret;
+    do {
+      zs.next_out = buf;
+      zs.avail_out = sizeof(buf);
+      ret = deflate (&zs, flush);
+      out.write ((const char*)buf, sizeof(buf) - zs.avail_out);
+    } while (ret == Z_OK && (zs.avail_out == 0 || flush == Z_FINISH));
+  }
+  
+  z_stream zs;
+  uint8_t buf[65536];
+};
+
 int PSCodec::readImage (std::istream* stream, Image& image, const std::string& decompres)
 {
     return false;
@@ -40,11 +305,16 @@ bool PSCodec::writeImage (std::ostream* stream, Image& image, int quality,
 
 	const char* creatorName = "ExactImage";
 
+	// Flate is a LanguageLevel 3 filter
+	Args args (compress);
+	const int level = args.contains ("flate") || args.contains ("deflate") ||
+	                  args.contains ("zip") ? 3 : 2;
+
 	*stream <<
 		"%!PS-Adobe-3.0\n"
 		"%%Creator:" << creatorName << "\n"
 		"%%DocumentData: Clean7Bit\n"
-		"%%LanguageLevel: 2\n"
+		"%%LanguageLevel: " << level << "\n"
 		"%%BoundingBox: 0 0 " << scale*(double)w << " " << scale*(double)h << "\n"
 		"%%EndComments\n"
 		"%%BeginProlog\n"
@@ -66,23 +336,62 @@ void PSCodec::encodeImage (std::ostream* stream, Image& image, double scale,
 	const int w = image.w;
 	const int h = image.h;
 
-	std::string encoding = "ASCII85Decode";
+	enum { NONE, FLATE, RUNLENGTH, CCITT, JPEG } compression = NONE;
+	bool hex = false, binary = false;
 
-	if (!compress.empty())
-	{
-		std::string c (compress);
-		std::transform (c.begin(), c.end(), c.begin(), tolower);
+	Args args (compress);
 
-		if (c == "encodeascii85")
-			encoding = "ASCII85Decode";
-		else if (c == "encodehex")
-			encoding = "ASCIIHexDecode";
-		else if (c == "encodejpeg")
-			encoding = "DCTDecode";
-		else
-			std::cerr << "PDFCodec: Unrecognized encoding option '" << compress << "'" << std::endl;
+	if (args.containsAndRemove ("hex") || args.containsAndRemove ("encodehex"))
+		hex = true;
+	// ASCII85 is the default
+	args.containsAndRemove ("ascii85");
+	args.containsAndRemove ("encodeascii85");
+
+	if (args.containsAndRemove ("flate") || args.containsAndRemove ("deflate") ||
+	    args.containsAndRemove ("zip"))
+		compression = FLATE;
+	else if (args.containsAndRemove ("runlength") || args.containsAndRemove ("rle"))
+		compression = RUNLENGTH;
+	else if (args.containsAndRemove ("ccitt") || args.containsAndRemove ("g4") ||
+	         args.containsAndRemove ("fax"))
+		compression = CCITT;
+	else if (args.containsAndRemove ("jpeg") || args.containsAndRemove ("dct"))
+		compression = JPEG;
+	else if (args.containsAndRemove ("encodejpeg")) {
+		// historically written as is, without an ASCII filter
+		compression = JPEG;
+		binary = true;
 	}
 
+#if WITHLIBJPEG != 1
+	if (compression == JPEG) {
+		std::cerr << "PSCodec: JPEG support not compiled in" << std::endl;
+		compression = NONE;
+		binary = false;
+	}
+#endif
+
+	std::string g4;
+	if (compression == CCITT) {
+#if WITHLIBTIFF == 1
+		if (image.bps != 1 || image.spp != 1)
+			std::cerr << "PSCodec: CCITT compression requires a bilevel image" << std::endl;
+		else if (!TIFCodec::encodeG4 (image, g4))
+			std::cerr << "PSCodec: Error encoding CCITT data" << std::endl;
+#else
+		std::cerr << "PSCodec: CCITT support not compiled in" << std::endl;
+#endif
+		if (g4.empty())
+			compression = NONE;
+	}
+
+	// the JPEG codec shall parse what remains, e.g. progressive
+	std::string jpeg_compress;
+	if (compression == JPEG)
+		jpeg_compress = args.str ();
+	else if (!args.str().empty())
+		std::cerr << "PSCodec: Unrecognized encoding option '" << args.str() << "'" << std::endl;
+
 	const char* decodeName = "Decode [0 1 0 1 0 1]";
 	const char* deviceName = "DeviceRGB";
 
@@ -103,22 +412,66 @@ void PSCodec::encodeImage (std::ostream* stream, Image& image, double scale,
 		"       0.0 " << -1.0 / scale << "\n"
 		"       0.0 " << h << "\n"
 		"   ]\n"
-		"   /DataSource currentfile /" << encoding << " filter\n"
+		"   /DataSource currentfile";
+	if (!binary)
+		*stream << (hex ? " /ASCIIHexDecode filter" : " /ASCII85Decode filter");
+	switch (compression) {
+	case FLATE: *stream << " /FlateDecode filter"; break;
+	case RUNLENGTH: *stream << " /RunLengthDecode filter"; break;
+	case CCITT:
+		*stream << " << /K -1 /Columns " << w << " /Rows " << h
+			<< " >> /CCITTFaxDecode filter";
+		break;
+	case JPEG: *stream << " /DCTDecode filter"; break;
+	default: break;
+	}
+	*stream << "\n"
 		">> image"
 		<< std::endl;
 
-	const int bytes = image.stride() * h;
-	uint8_t* data = image.getRawData();
-	if (encoding == "ASCII85Decode")
-		EncodeASCII85(*stream, data, bytes);
-	else if (encoding == "ASCIIHexDecode")
-		EncodeHex(*stream, data, bytes);
+	PSFilter* ascii = 0;
+	if (!binary) {
+		if (hex)
+			ascii = new HexFilter (*stream);
+		else
+			ascii = new ASCII85Filter (*stream);
+	}
+	std::ostream asciistream (ascii);
+
+	if (compression == CCITT) {
+		ascii->write ((const uint8_t*)g4.data(), g4.size());
+	}
 #if WITHLIBJPEG == 1
-	else {
+	else if (compression == JPEG) {
 		JPEGCodec codec;
-		codec.writeImage (stream, image, quality, compress);
+		codec.writeImage (binary ? stream : &asciistream, image,
+				  quality, jpeg_compress);
 	}
 #endif
+	else {
+		PSFilter* compressor = 0;
+		if (compression == FLATE)
+			compressor = new FlateFilter (asciistream);
+		else if (compression == RUNLENGTH)
+			compressor = new RunLengthFilter (asciistream);
+		PSFilter* sink = compressor ? compressor : ascii;
+
+		// one row at a time, thus constant memory regardless of the size
+		const int stride = image.stride();
+		const uint8_t* data = image.getRawData();
+		for (int y = 0; y < h; ++y, data += stride)
+			sink->write (data, stride);
+
+		if (compressor) {
+			compressor->finish ();
+			delete compressor;
+		}
+	}
+
+	if (ascii) {
+		ascii->finish ();
+		delete ascii;
+	}
 	stream->put('\n');
 }
 
@@ -41,6 +41,33 @@ int SVGCodec::readImage (std::istream* stream, Image& image, const std::string&
   if (stream->peek () != '<')
     return false;
 
+  // rasterize at the needed size right away: dpi=N (96 being 1:1) or scale=F
+  double scale = 1;
+  int dpi = 0;
+  {
+    Args args (decompres);
+    std::string arg = args.containsPrefixedAndRemove ("dpi=");
+    if (!arg.empty()) {
+      dpi = atoi (arg.c_str());
+      if (dpi > 0)
+	scale = dpi / 96.;
+      else {
+	std::cerr << "SVGCodec: Invalid resolution: '" << arg << "'" << std::endl;
+	dpi = 0;
+      }
+    }
+    arg = args.containsPrefixedAndRemove ("scale=");
+    if (!arg.empty()) {
+      double s = atof (arg.c_str());
+      if (s > 0)
+	scale = s;
+      else
+	std::cerr << "SVGCodec: Invalid scale: '" << arg << "'" << std::endl;
+    }
+    if (!args.str().empty())
+      std::cerr << "SVGCodec: Unrecognized decompression option '" << args.str() << "'" << std::endl;
+  }
+  
   try
     {
       p.parse(*stream);
@@ -73,7 +100,8 @@ int SVGCodec::readImage (std::istream* stream, Image& image, const std::string&
     max_y += 1;
 
   image.bps = 8; image.spp = 3;
-  image.resize ((int)(max_x - min_x), (int)(max_y - min_y));
+  image.resize ((int)((max_x - min_x) * scale), (int)((max_y - min_y) * scale));
+  image.setResolution (dpi, dpi);
   
   renderer_exact_image rb (image);
   typedef agg::renderer_scanline_aa_solid<renderer_base> renderer_solid;
@@ -86,11 +114,7 @@ int SVGCodec::readImage (std::istream* stream, Image& image, const std::string&
   agg::trans_affine mtx;
   
   ras.gamma(agg::gamma_power(gamma));
-  mtx *= agg::trans_affine_translation ((min_x + max_x) * -0.5,
-					(min_y + max_y) * -0.5);
-  //mtx *= agg::trans_affine_scaling (scale);
-  mtx *= agg::trans_affine_translation ((min_x + max_x) * 0.5,
-					(min_y + max_y) * 0.5);
+  mtx *= agg::trans_affine_scaling (scale);
   
   m_path.expand(expand);
   m_path.render(ras, sl, ren, mtx, rb.clip_box(), 1.0);
@@ -26,6 +26,8 @@
 
 #include <algorithm>
 #include <iostream>
+#include <sstream>
+#include <vector>
 
 /* Well, sadly our own c++ glue, the libtiff native one does not provide
    readble out streams it requires for multi-page files, ... */
@@ -328,12 +330,12 @@ static TIFF* TIFFStreamOpen(const char* name, std::istream* is)
 
 /* back to our codec */
 
-TIFCodec::TIFCodec () : tiffCtx(0) {
+TIFCodec::TIFCodec () : tiffCtx(0), pages(0), page(0) {
   registerCodec ("tiff", this);
   registerCodec ("tif", this);
 }
 
-TIFCodec::TIFCodec (TIFF* ctx) : tiffCtx(ctx) {
+TIFCodec::TIFCodec (TIFF* ctx) : tiffCtx(ctx), pages(0), page(0) {
 }
 
 TIFCodec::~TIFCodec()
@@ -342,22 +344,25 @@ TIFCodec::~TIFCodec()
     TIFFClose(tiffCtx);
 }
 
+static bool isTIFF (std::istream* stream)
+{
+  char a, b;
+  a = stream->get ();
+  b = stream->peek ();
+  stream->putback (a);
+  
+  int magic = (a << 8) | b;
+  
+  return magic == TIFF_BIGENDIAN || magic == TIFF_LITTLEENDIAN;
+}
+
 int TIFCodec::readImage (std::istream* stream, Image& image, const std::string& decompres, int index)
 {
   TIFF* in;
 
   // quick magic check
-  {
-    char a, b;
-    a = stream->get ();
-    b = stream->peek ();
-    stream->putback (a);
-    
-    int magic = (a << 8) | b;
-    
-    if (magic != TIFF_BIGENDIAN && magic != TIFF_LITTLEENDIAN)
-      return false;
-  }
+  if (!isTIFF (stream))
+    return false;
   
   in = TIFFStreamOpen ("", stream);
   if (!in)
@@ -370,6 +375,19 @@ int TIFCodec::readImage (std::istream* stream, Image& image, const std::string&
       return false;
     }
   
+  if (!readDirectory (in, image)) {
+    TIFFClose(in);
+    stream->seekg(0);
+    return false;
+  }
+  
+  TIFFClose (in);
+  return n_images;
+}
+
+// decodes the current directory
+bool TIFCodec::readDirectory (TIFF* in, Image& image)
+{
   uint16 photometric = 0;
   TIFFGetField(in, TIFFTAG_PHOTOMETRIC, &photometric);
   // std::cerr << "photometric: " << (int)photometric << std::endl;
@@ -382,7 +400,6 @@ int TIFCodec::readImage (std::istream* stream, Image& image, const std::string&
       break;
     default:
       std::cerr << "TIFCodec: Unrecognized photometric: " << (int)photometric << std::endl;
-      TIFFClose(in);
       return false;
     }
   
@@ -397,11 +414,8 @@ int TIFCodec::readImage (std::istream* stream, Image& image, const std::string&
   uint16 config;
   TIFFGetField(in, TIFFTAG_PLANARCONFIG, &config);
   
-  if (!_w || !_h || !_spp || !_bps) {
-    TIFFClose(in);
-    stream->seekg(0);
+  if (!_w || !_h || !_spp || !_bps)
     return false;
-  }
   
   image.spp = _spp;
   image.bps = _bps;
@@ -479,10 +493,125 @@ int TIFCodec::readImage (std::istream* stream, Image& image, const std::string&
     /* free'd by TIFFClose; free(rmap); free(gmap); free(bmap); */
   }
   
+  return true;
+}
+
+static const char* compressionName (uint16 compression)
+{
+  switch (compression) {
+  case COMPRESSION_NONE: return "none";
+  case COMPRESSION_CCITTRLE: return "ccittrle";
+  case COMPRESSION_CCITTFAX3: return "g3";
+  case COMPRESSION_CCITTFAX4: return "g4";
+  case COMPRESSION_LZW: return "lzw";
+  case COMPRESSION_OJPEG: return "ojpeg";
+  case COMPRESSION_JPEG: return "jpeg";
+  case COMPRESSION_ADOBE_DEFLATE:
+  case COMPRESSION_DEFLATE: return "deflate";
+  case COMPRESSION_PACKBITS: return "packbits";
+  default: return "unknown";
+  }
+}
+
+int TIFCodec::probeImage (std::istream* stream, Image& image, int index)
+{
+  // quick magic check
+  if (!isTIFF (stream))
+    return false;
+  
+  TIFF* in = TIFFStreamOpen ("", stream);
+  if (!in)
+    return false;
+  
+  int n_images = TIFFNumberOfDirectories(in);
+  if (index > 0 || index != TIFFCurrentDirectory(in))
+    if (!TIFFSetDirectory(in, index)) {
+      TIFFClose(in);
+      return false;
+    }
+  
+  uint32 _w = 0, _h = 0;
+  uint16 _spp = 0, _bps = 0, compression = COMPRESSION_NONE;
+  TIFFGetField(in, TIFFTAG_IMAGEWIDTH, &_w);
+  TIFFGetField(in, TIFFTAG_IMAGELENGTH, &_h);
+  TIFFGetField(in, TIFFTAG_SAMPLESPERPIXEL, &_spp);
+  TIFFGetField(in, TIFFTAG_BITSPERSAMPLE, &_bps);
+  TIFFGetField(in, TIFFTAG_COMPRESSION, &compression);
+  
+  if (!_w || !_h || !_spp || !_bps) {
+    TIFFClose(in);
+    return false;
+  }
+  
+  image.w = _w;
+  image.h = _h;
+  image.spp = _spp;
+  image.bps = _bps;
+  if (image.spp == 2) { // as remapped by readImage
+    image.spp = 1;
+    image.bps *= 2;
+  }
+  
+  // palette images are de-paletted by readImage, report what it yields
+  uint16 photometric = 0;
+  TIFFGetField(in, TIFFTAG_PHOTOMETRIC, &photometric);
+  if (photometric == PHOTOMETRIC_PALETTE) {
+    int spp = image.spp, bps = image.bps;
+    uint16 *rmap = 0, *gmap = 0, *bmap = 0;
+    if (bps <= 16 &&
+	TIFFGetField(in, TIFFTAG_COLORMAP, &rmap, &gmap, &bmap))
+      colorspace_de_palette_format (spp, bps, 1 << bps, rmap, gmap, bmap);
+    else {
+      spp = 3; bps = 8;
+    }
+    image.spp = spp;
+    image.bps = bps;
+  }
+  
+  float _xres, _yres;
+  if (!TIFFGetField(in, TIFFTAG_XRESOLUTION, &_xres))
+    _xres = 0;
+  if (!TIFFGetField(in, TIFFTAG_YRESOLUTION, &_yres))
+    _yres = 0;
+  image.setResolution(_xres, _yres);
+  image.setCompression(compressionName(compression));
+  
   TIFFClose (in);
   return n_images;
 }
 
+// for multi-page reading, the directories are visited sequentially
+ImageCodec* TIFCodec::instanciateForRead (std::istream* stream, const std::string& decompress)
+{
+  if (!isTIFF (stream))
+    return 0;
+  
+  TIFF* in = TIFFStreamOpen ("", stream);
+  if (in == NULL)
+    return 0;
+  
+  TIFCodec* codec = new TIFCodec(in);
+  codec->pages = TIFFNumberOfDirectories(in);
+  return codec;
+}
+
+int TIFCodec::Read (Image& image)
+{
+  if (page >= pages)
+    return 0;
+  
+  // the first directory is current after opening
+  if (page > 0 && !TIFFReadDirectory(tiffCtx))
+    return 0;
+  ++page;
+  
+  if (!readDirectory (tiffCtx, image))
+    return 0;
+  
+  image.setDecoderID (getID ());
+  return pages;
+}
+
 // for multi-page writing
 ImageCodec* TIFCodec::instanciateForWrite (std::ostream* stream, const std::string& compress)
 {
@@ -512,35 +641,252 @@ bool TIFCodec::writeImage (std::ostream* stream, Image& image, int quality,
   return ret;
 }
 
+// read back the raw, compressed first chunk of an in-memory TIFF
+static bool readRawChunk (std::stringstream& stream, bool tiled,
+			  std::string& encoded)
+{
+  stream.seekg (0);
+  TIFF* in = TIFFStreamOpen ("", (std::istream*)&stream);
+  if (!in)
+    return false;
+  
+  tsize_t rawsize = TIFFRawStripSize (in, 0);
+  if (rawsize <= 0) {
+    TIFFClose (in);
+    return false;
+  }
+  
+  encoded.resize (rawsize);
+  tsize_t err = tiled ? TIFFReadRawTile (in, 0, &encoded[0], rawsize) :
+                        TIFFReadRawStrip (in, 0, &encoded[0], rawsize);
+  TIFFClose (in);
+  if (err != rawsize)
+    return false;
+  
+  return true;
+}
+
+/* To spread the (quite expensive Deflate / LZW) compression over multiple
+   cores, each strip or tile is encoded on its own into an in-memory,
+   single chunk TIFF by a private libtiff handle. The raw, compressed
+   chunk is then read back and appended in order to the real output via
+   TIFFWriteRawStrip / TIFFWriteRawTile. As strips and tiles are
+   compressed independently this yields the very same data libtiff would
+   have written itself. */
+
+static bool encodeChunk (uint16 compression, uint16 photometric,
+			 uint16 bps, uint16 spp, uint32 w, uint32 h, bool tiled,
+			 uint8_t* data, tsize_t size, std::string& encoded)
+{
+  std::stringstream stream;
+  
+  TIFF* tmp = TIFFStreamOpen ("", (std::ostream*)&stream);
+  if (!tmp)
+    return false;
+  
+  TIFFSetField (tmp, TIFFTAG_IMAGEWIDTH, w);
+  TIFFSetField (tmp, TIFFTAG_IMAGELENGTH, h);
+  TIFFSetField (tmp, TIFFTAG_BITSPERSAMPLE, bps);
+  TIFFSetField (tmp, TIFFTAG_SAMPLESPERPIXEL, spp);
+  TIFFSetField (tmp, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+  TIFFSetField (tmp, TIFFTAG_COMPRESSION, compression);
+  TIFFSetField (tmp, TIFFTAG_PHOTOMETRIC, photometric);
+  if (tiled) {
+    TIFFSetField (tmp, TIFFTAG_TILEWIDTH, w);
+    TIFFSetField (tmp, TIFFTAG_TILELENGTH, h);
+  }
+  else
+    TIFFSetField (tmp, TIFFTAG_ROWSPERSTRIP, h);
+  
+  tsize_t err = tiled ? TIFFWriteEncodedTile (tmp, 0, data, size) :
+                        TIFFWriteEncodedStrip (tmp, 0, data, size);
+  if (err < 0 || !TIFFWriteDirectory (tmp)) {
+    TIFFClose (tmp);
+    return false;
+  }
+  TIFFClose (tmp);
+  
+  return readRawChunk (stream, tiled, encoded);
+}
+
+static bool writeImageParallel (TIFF* out, const Image& image,
+				uint16 compression, uint16 photometric,
+				uint32 tilewidth, uint32 tilelength)
+{
+  const bool tiled = tilewidth > 0;
+  const unsigned stride = image.stride();
+  const int bpp = image.bitsPerPixel();
+  
+  // chunk geometry, for strips a chunk is just a tile as wide as the image
+  const uint32 cw = tiled ? tilewidth : image.w;
+  const uint32 ch = tilelength;
+  const int across = (image.w + cw - 1) / cw;
+  const int down = (image.h + ch - 1) / ch;
+  const int chunks = across * down;
+  
+  // packed bytes per chunk row, tile widths are multiples of 16 thus
+  // always byte aligned, even for sub-byte pixels
+  const unsigned cstride = (cw * bpp + 7) / 8;
+  
+  uint8_t* data = image.getRawData();
+  std::vector<std::string> encoded (chunks);
+  
+  // a failed chunk is left empty, checked after the threads joined
+#pragma omp parallel for schedule (dynamic, 1)
+  for (int i = 0; i < chunks; ++i)
+    {
+      const uint32 x0 = (i % across) * cw;
+      const uint32 y0 = (i / across) * ch;
+      
+      // strips are cut short at the image end, tiles are always padded
+      const uint32 rows = tiled ? ch : std::min (ch, image.h - y0);
+      const unsigned xoff = x0 * bpp / 8;
+      const unsigned bytes = std::min (cstride, stride - xoff);
+      
+      std::vector<uint8_t> buffer (cstride * rows, 0);
+      for (uint32 y = 0; y < rows && y0 + y < (uint32)image.h; ++y) {
+	const uint8_t* src = data + (y0 + y) * stride + xoff;
+	uint8_t* dst = &buffer[y * cstride];
+	
+	// Note: we on-the-fly invert 1-bit data, as for the scanline path
+	if (image.bps == 1)
+	  for (unsigned j = 0; j < bytes; ++j)
+	    dst[j] = src[j] ^ 0xFF;
+	else
+	  memcpy (dst, src, bytes);
+      }
+      
+      if (!encodeChunk (compression, photometric, image.bps, image.spp,
+			cw, rows, tiled, &buffer[0], buffer.size(), encoded[i]))
+	encoded[i].clear ();
+    }
+  
+  for (int i = 0; i < chunks; ++i)
+    if (encoded[i].empty()) {
+      std::cerr << "TIFCodec: Error encoding " << (tiled ? "tile" : "strip") << std::endl;
+      return false;
+    }
+  
+  // write in order
+  for (int i = 0; i < chunks; ++i) {
+    tsize_t err = tiled ?
+      TIFFWriteRawTile (out, i, &encoded[i][0], encoded[i].size()) :
+      TIFFWriteRawStrip (out, i, &encoded[i][0], encoded[i].size());
+    if (err < 0)
+      return false;
+    std::string().swap (encoded[i]); // release early
+  }
+  
+  return true;
+}
+
+/* The bare CCITT Group 4 data of a bilevel image, as consumed by
+   e.g. PostScript's and PDF's CCITTFaxDecode filter with /K -1. The
+   scanlines are encoded as one strip, 1 bits are black just as for our
+   MINISWHITE TIFFs. */
+
+bool TIFCodec::encodeG4 (Image& image, std::string& encoded)
+{
+  if (image.bps != 1 || image.spp != 1)
+    return false;
+  
+  std::stringstream stream;
+  
+  TIFF* tmp = TIFFStreamOpen ("", (std::ostream*)&stream);
+  if (!tmp)
+    return false;
+  
+  TIFFSetField (tmp, TIFFTAG_IMAGEWIDTH, image.w);
+  TIFFSetField (tmp, TIFFTAG_IMAGELENGTH, image.h);
+  TIFFSetField (tmp, TIFFTAG_BITSPERSAMPLE, 1);
+  TIFFSetField (tmp, TIFFTAG_SAMPLESPERPIXEL, 1);
+  TIFFSetField (tmp, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+  TIFFSetField (tmp, TIFFTAG_COMPRESSION, COMPRESSION_CCITTFAX4);
+  TIFFSetField (tmp, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISWHITE);
+  TIFFSetField (tmp, TIFFTAG_ROWSPERSTRIP, image.h);
+  
+  const int stride = image.stride();
+  const uint8_t* src = image.getRawData();
+  std::vector<uint8_t> scanline (stride);
+  
+  for (int row = 0; row < image.h; ++row, src += stride) {
+    for (int i = 0; i < stride; ++i)
+      scanline[i] = src[i] ^ 0xFF;
+    if (TIFFWriteScanline (tmp, &scanline[0], row, 0) < 0) {
+      TIFFClose (tmp);
+      return false;
+    }
+  }
+  
+  if (!TIFFWriteDirectory (tmp)) {
+    TIFFClose (tmp);
+    return false;
+  }
+  TIFFClose (tmp);
+  
+  return readRawChunk (stream, false, encoded);
+}
+
 bool TIFCodec::writeImageImpl (TIFF* out, const Image& image, const std::string& compress,
 			       int page)
 {
   uint32 rowsperstrip = (uint32)-1;
+  uint32 tilewidth = 0, tilelength = 0;
   
   uint16 compression = image.bps == 1 ? COMPRESSION_CCITTFAX4 :
                                         COMPRESSION_DEFLATE;
 
-  if (!compress.empty())
+  Args args (compress);
+  
+  if (args.containsAndRemove("g3") || args.containsAndRemove("fax") ||
+      args.containsAndRemove("group3"))
+    compression = COMPRESSION_CCITTFAX3;
+  else if (args.containsAndRemove("g4") || args.containsAndRemove("group4"))
+    compression = COMPRESSION_CCITTFAX4;
+  else if (args.containsAndRemove("lzw"))
+    compression = COMPRESSION_LZW;
+  else if (args.containsAndRemove("deflate") || args.containsAndRemove("zip"))
+    compression = COMPRESSION_DEFLATE;
+  else if (args.containsAndRemove("packbits"))
+    compression = COMPRESSION_PACKBITS;
+  else if (args.containsAndRemove("none"))
+    compression = COMPRESSION_NONE;
+  
+  // tiled, e.g.: tile, tile=512 or tile=512x256, multiples of 16
   {
-    std::string c (compress);
-    std::transform (c.begin(), c.end(), c.begin(), tolower);
-    
-    if (c == "g3" || c == "fax" || c == "group3")
-      compression = COMPRESSION_CCITTFAX3;
-    else if (c == "g4" || c == "group4")
-      compression = COMPRESSION_CCITTFAX4;
-    else if (c == "lzw")
-      compression = COMPRESSION_LZW;
-    else if (c == "deflate" || c == "zip")
-      compression = COMPRESSION_DEFLATE;
-    else if (c == "packbits")
-      compression = COMPRESSION_PACKBITS;
-    else if (c == "none")
-      compression = COMPRESSION_NONE;
-    else
-      std::cerr << "TIFCodec: Unrecognized compression option '" << compress << "'" << std::endl;
+    std::string arg = args.containsPrefixedAndRemove("tile=");
+    if (!arg.empty()) {
+      unsigned tw = 0, th = 0;
+      int n = sscanf (arg.c_str(), "%ux%u", &tw, &th);
+      if (n == 1)
+	th = tw;
+      if (n < 1 || tw == 0 || th == 0 || tw % 16 || th % 16)
+	std::cerr << "TIFCodec: Tile size must be multiple of 16: '" << arg << "'" << std::endl;
+      else {
+	tilewidth = tw;
+	tilelength = th;
+      }
+    }
+    else if (args.containsAndRemove("tile"))
+      tilewidth = tilelength = 256;
   }
   
+  // large(r) strips, encoded in parallel: strip=rows
+  {
+    std::string arg = args.containsPrefixedAndRemove("strip=");
+    if (!arg.empty()) {
+      int rows = atoi (arg.c_str());
+      if (rows > 0)
+	rowsperstrip = rows;
+      else
+	std::cerr << "TIFCodec: Invalid strip size: '" << arg << "'" << std::endl;
+    }
+  }
+  const bool parallel = tilewidth || rowsperstrip != (uint32)-1;
+  
+  if (!args.str().empty())
+    std::cerr << "TIFCodec: Unrecognized compression option '" << args.str() << "'" << std::endl;
+  
   if (page) {
     TIFFSetField (out, TIFFTAG_SUBFILETYPE, FILETYPE_PAGE);
     TIFFSetField (out, TIFFTAG_PAGENUMBER, page, 0); // total number unknown
@@ -554,22 +900,25 @@ bool TIFCodec::writeImageImpl (TIFF* out, const Image& image, const std::string&
   TIFFSetField (out, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
 
   TIFFSetField (out, TIFFTAG_COMPRESSION, compression);
+  
+  uint16 photometric;
   if (image.spp == 1 && image.bps == 1)
     // internally we actually have MINISBLACK, but some programs,
     // including older Apple Preview.app appear to ignore this bit
-    TIFFSetField (out, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISWHITE);
+    photometric = PHOTOMETRIC_MINISWHITE;
   else if (image.spp == 1)
-    TIFFSetField (out, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+    photometric = PHOTOMETRIC_MINISBLACK;
   else if (false) { // just saved for reference
     uint16 rmap[256], gmap[256], bmap[256];
     for (int i = 0;i < 256; ++i) {
       rmap[i] = gmap[i] = bmap[i] = i * 0xffff / 255;
     }
-    TIFFSetField (out, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_PALETTE);
+    photometric = PHOTOMETRIC_PALETTE;
     TIFFSetField (out, TIFFTAG_COLORMAP, rmap, gmap, bmap);
   }
   else
-    TIFFSetField (out, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+    photometric = PHOTOMETRIC_RGB;
+  TIFFSetField (out, TIFFTAG_PHOTOMETRIC, photometric);
   
   if (image.resolutionX() != 0) {
     float _xres = image.resolutionX();
@@ -585,8 +934,22 @@ bool TIFCodec::writeImageImpl (TIFF* out, const Image& image, const std::string&
     TIFFSetField (out, TIFFTAG_SOFTWARE, "ExactImage");
   }
   //TIFFSetField (out, TIFFTAG_IMAGEDESCRIPTION, "");
-  rowsperstrip = TIFFDefaultStripSize (out, rowsperstrip); 
-  TIFFSetField (out, TIFFTAG_ROWSPERSTRIP, rowsperstrip);
+  
+  if (tilewidth) {
+    TIFFSetField (out, TIFFTAG_TILEWIDTH, tilewidth);
+    TIFFSetField (out, TIFFTAG_TILELENGTH, tilelength);
+  }
+  else {
+    rowsperstrip = TIFFDefaultStripSize (out, rowsperstrip);
+    TIFFSetField (out, TIFFTAG_ROWSPERSTRIP, rowsperstrip);
+  }
+  
+  if (parallel) {
+    if (!writeImageParallel (out, image, compression, photometric,
+			     tilewidth, tilewidth ? tilelength : rowsperstrip))
+      return false;
+    return TIFFWriteDirectory(out);
+  }
   
   const int stride = image.stride();
   
@@ -30,6 +30,7 @@ public:
   virtual std::string getID () { return "TIFF"; };
   
   virtual int readImage (std::istream* stream, Image& image, const std::string& decompres, int index);
+  virtual int probeImage (std::istream* stream, Image& image, int index);
   virtual bool writeImage (std::ostream* stream, Image& image,
 			   int quality, const std::string& compress);
 
@@ -38,9 +39,18 @@ public:
   virtual bool Write (Image& image,
 		      int quality, const std::string& compress, int index);
   
+  // for multi-page reading
+  virtual ImageCodec* instanciateForRead (std::istream* stream, const std::string& decompress);
+  virtual int Read (Image& image);
+  
+  // raw CCITT Group 4 data of a bilevel image, e.g. for CCITTFaxDecode
+  static bool encodeG4 (Image& image, std::string& encoded);
+  
 private:
   
+  static bool readDirectory (TIFF* in, Image& image);
   static bool writeImageImpl (TIFF* out, const Image& image, const std::string& compress, int page = 0);
 
   TIFF* tiffCtx;
+  int pages, page; // multi-page reading
 };
@@ -42,6 +42,7 @@ using namespace Utility;
 #include "Colorspace.hh"
 
 #include "rotate.hh"
+#include "scale.hh"
 
 #include "edisplay.hh"
 
@@ -55,14 +56,18 @@ static uint32_t evas_bgr_image_data[] = {
   0x999999, 0x666666,
   0x666666, 0x999999};
 
+// pyramid tile size, and the size from which JPEGs get a quick preview
+static const int tile_size = 256;
+static const int preview_size = 2048;
+
 int Viewer::Window2ImageX (int x)
 {
-  return (x - evas_image->X() ) * 100 / zoom;
+  return (x - view_x) * 100 / zoom;
 }
 
 int Viewer::Window2ImageY (int y)
 {
-  return (y - evas_image->Y() ) * 100 / zoom;
+  return (y - view_y) * 100 / zoom;
 }
 
 void Viewer::Zoom (double f)
@@ -81,8 +86,8 @@ void Viewer::Zoom (double f)
   
   SetOSDZoom ();
   
-  Evas_Coord w = (Evas_Coord) (zoom * image->w / 100);
-  Evas_Coord h = (Evas_Coord) (zoom * image->h / 100);
+  Evas_Coord w = (Evas_Coord) (zoom * image_w / 100);
+  Evas_Coord h = (Evas_Coord) (zoom * image_h / 100);
   {
     if (image->resolutionX() > 0 && image->resolutionY() > 0)
       h = h * image->resolutionX() / image->resolutionY();
@@ -90,12 +95,15 @@ void Viewer::Zoom (double f)
   evas_bgr_image->Resize (w, h);
   
   // recenter view
+  view_w = w;
+  view_h = h;
+  view_x = - (xcent * zoom / 100 - (evas->OutputWidth() / 2));
+  view_y = - (ycent * zoom / 100 - (evas->OutputHeight() / 2));
   for (std::vector<EvasImage*>::iterator it = evas_content.begin();
        it != evas_content.end(); ++it) {
     (*it)->Resize (w, h);
     (*it)->ImageFill (0, 0, w, h);
-    (*it)->Move (- (xcent * zoom / 100 - (evas->OutputWidth() / 2)),
-		 - (ycent * zoom / 100 - (evas->OutputHeight() / 2)) );
+    (*it)->Move (view_x, view_y);
   }
 
   // limit / clip accordingly
@@ -111,11 +119,11 @@ void Viewer::Zoom (double f)
 
 void Viewer::Move (int _x, int _y)
 {
-  Evas_Coord x = evas_image->X() + _x;
-  Evas_Coord y = evas_image->Y() + _y;
+  Evas_Coord x = view_x + _x;
+  Evas_Coord y = view_y + _y;
   
-  Evas_Coord w = evas_image->Width();
-  Evas_Coord h = evas_image->Height();
+  Evas_Coord w = view_w;
+  Evas_Coord h = view_h;
   
   // limit
   if (x + w < evas->OutputWidth() )
@@ -128,9 +136,13 @@ void Viewer::Move (int _x, int _y)
   if (y > 0)
     y = 0;
   
+  view_x = x;
+  view_y = y;
   for (std::vector<EvasImage*>::iterator it = evas_content.begin();
        it != evas_content.end(); ++it)
     (*it)->Move (x, y);
+  
+  UpdateTiles ();
 }
 
 
@@ -165,7 +177,7 @@ void Viewer::SetOSDZoom ()
 {
   std::stringstream s1, s2;
   s1 << "Zoom: " << zoom << "%";
-  s2 << "Anti-alias: " << (evas_image->SmoothScale() ? "yes" : "no");
+  s2 << "Anti-alias: " << (smooth ? "yes" : "no");
   
   UpdateOSD (s1.str(), s2.str());
 }
@@ -407,10 +419,12 @@ int Viewer::Run (bool opengl)
 	      }
 	      break;
 	    case ButtonRelease:
-	      if (!dnd_moved)
+	      if (!dnd_moved) {
+		FinishPyramid ();
 		ImageClicked(Window2ImageX (ev.xmotion.x),
 			     Window2ImageY (ev.xmotion.y),
 			     ev.xbutton.button);
+	      }
 	      break;
 	      
 	    case MotionNotify:
@@ -432,7 +446,8 @@ int Viewer::Run (bool opengl)
 		  int x = Window2ImageX (ev.xmotion.x);
 		  int y = Window2ImageY (ev.xmotion.y);
 		  
-		  if (x <= image->w && y <= image->h) {
+		  if (x >= 0 && y >= 0 && x < image_w && y < image_h &&
+		      ImageReady ()) {
 		    uint16_t r = 0, g = 0, b = 0;
 		    
 		    Image::iterator it = image->begin();
@@ -454,6 +469,8 @@ int Viewer::Run (bool opengl)
 	    case KeyPress:
 	      KeySym ks;	      
 	      XLookupString ((XKeyEvent*)&ev, 0, 0, &ks, NULL);
+	      // zoom, pan, etc. do not wait for the pyramid, only the
+	      // handlers touching the pixels join it
 	      if (ImageKey(ks))
 		break;
 	      
@@ -514,7 +531,7 @@ int Viewer::Run (bool opengl)
 		    channel = 0;
 		  else if (channel < 0)
 		    channel = 6;
-		  ImageToEvas ();
+		  UpdateTiles (true);
 		  {
 		    std::string s1, s2;
 		    s1 = "Color channel";
@@ -533,7 +550,9 @@ int Viewer::Run (bool opengl)
 		  break;
 		  
 		case XK_a:
-		  evas_image->SmoothScale (!evas_image->SmoothScale());
+		  smooth = !smooth;
+		  for (tiles_t::iterator it = tiles.begin(); it != tiles.end(); ++it)
+		    it->second.eimage->SmoothScale (smooth);
 		  // schedule the update
 		  evas->DamageRectangleAdd (0, 0,
 					    evas->OutputWidth(),
@@ -543,18 +562,21 @@ int Viewer::Run (bool opengl)
 		  break;
 
 		case XK_i:
+		  FinishPyramid ();
 		  invert (*image);
 		  ImageToEvas ();
 		  AlphaOSD (0);
 		  break;
 
 		case XK_greater:
+		  FinishPyramid ();
 		  rotate (*image, 90, image->begin());
 		  ImageToEvas ();
 		  AlphaOSD (0);
 		  break;
 		
 		case XK_less:
+		  FinishPyramid ();
 		  rotate (*image, -90, image->begin());
 		  ImageToEvas ();
 		  AlphaOSD (0);
@@ -590,16 +612,33 @@ int Viewer::Run (bool opengl)
 	      break;
 	    }
 	}
+      
+      // pick up the levels refined in the background
+      pthread_mutex_lock (&pyramid_mutex);
+      const bool changed = pyramid_changed, failed = pyramid_failed;
+      pthread_mutex_unlock (&pyramid_mutex);
+      if (failed) {
+	// deferred decoding failed, skip it like Load() failing would,
+	// but do not cycle forever thru undecodable images
+	if (++failed_loads >= images.size())
+	  image_loaded = false;
+	else
+	  image_loaded = Next ();
+	continue;
+      }
+      if (changed) {
+	failed_loads = 0;
+	UpdateTiles ();
+      }
+      
       TickOSD ();
       evas->Render ();
       XFlush (dpy);
       usleep (10000);
     }
   
-  if (evas_image) {
-    delete evas_image;
-    evas_image = 0;
-  }
+  FinishPyramid ();
+  ClearTiles ();
   
   delete evas_osd_text1; evas_osd_text1 = 0;
   delete evas_osd_text2; evas_osd_text2 = 0;
@@ -643,6 +682,10 @@ bool Viewer::Previous ()
 
 bool Viewer::Load ()
 {
+  FinishPyramid ();
+  ClearPyramid ();
+  delete preview; preview = 0;
+  
   image->setRawData(0);
   
   // reset channel filter
@@ -663,27 +706,41 @@ bool Viewer::Load ()
        << " @ " << image->resolutionX() << "x" << image->resolutionY()
        << " dpi - spp: " << image->spp << ", bps: " << image->bps << endl;
   
-  // convert colorspace
-  if (image->bps == 16)
-    colorspace_16_to_8 (*image);
-  
-  // convert any gray to RGB
-  if (image->spp == 1)
-    colorspace_grayX_to_rgb8 (*image);
-  
-  if (image->bps != 8 || (image->spp != 3 && image->spp != 4)) {
+  // converted to 8 bit RGB(A) by the pyramid thread, check ahead
+  if ((image->spp != 1 && image->spp != 3 && image->spp != 4) ||
+      (image->spp != 1 && image->bps != 8 && image->bps != 16)) {
     cerr << "Unsupported colorspace. bps: " << image->bps
 	 << ", spp: " << image->spp << endl;
     cerr << "If possible please send a test image to rene@exactcode.de."
 	 << endl;
     return false;
   }
-
-  if (!image->getRawData()) {
+  
+  // decoded already, unless deferred to the pyramid thread by the codec
+  if (!image->getCodec() && !image->getRawData()) {
     cerr << "image data not loaded?"<< endl;
     return false;
   }
   
+  // large JPEGs are not decoded yet, show a DCT scaled decode at once
+  if (image->getDecoderID() == "JPEG" &&
+      std::max (image->w, image->h) > preview_size) {
+    double factor = 1./8;
+    while (factor < .5 && std::max (image->w, image->h) * factor < preview_size / 2)
+      factor *= 2;
+    
+    preview = new Image;
+    if (ImageCodec::Read(*it, *preview)) {
+      thumbnail_scale (*preview, factor, factor);
+      if (preview->spp == 1)
+	colorspace_grayX_to_rgb8 (*preview);
+    }
+    if (!preview->getRawData() || preview->bps != 8 ||
+	(preview->spp != 3 && preview->spp != 4)) {
+      delete preview; preview = 0;
+    }
+  }
+  
   ImageToEvas ();
   
   std::string title = *it;
@@ -695,18 +752,13 @@ bool Viewer::Load ()
 
 void Viewer::ImageToEvas ()
 {
-  if (!evas_image) {
-    evas_image = new EvasImage (*evas);
-    evas_image->SmoothScale (false);
-    evas_image->Layer (1);
-    evas_image->Move (0, 0);
-    evas_image->Resize (image->w, image->h);
-    evas_content.push_back(evas_image);
-  } else {
-    evas_image->SetData (0);
-  }
-
-  evas_image = ImageToEvas (image, evas_image);
+  // (re)build the pyramid of the new or modified image, keep zoom
+  FinishPyramid ();
+  ClearPyramid ();
+  
+  image_w = image->w;
+  image_h = image->h;
+  StartPyramid ();
   
   // position and resize, keep zoom
   if (false) {
@@ -715,74 +767,244 @@ void Viewer::ImageToEvas ()
   Zoom (1.0);
 }
 
-EvasImage* Viewer::ImageToEvas (Image* image, EvasImage* eimage)
+void Viewer::StartPyramid ()
+{
+  pyramid_running = pthread_create (&pyramid_thread, 0, BuildPyramid, this) == 0;
+  if (!pyramid_running)
+    BuildPyramid (this);
+}
+
+void Viewer::FinishPyramid ()
 {
-  if (!eimage) {
-    eimage = new EvasImage (*evas);
-    eimage->SmoothScale (false);
-    eimage->Layer (1);
-    eimage->Move (0, 0);
-    eimage->Resize (image->w, image->h);
-  } else {
-    eimage->SetData (0);
+  if (pyramid_running) {
+    pthread_join (pyramid_thread, 0);
+    pyramid_running = false;
   }
+}
+
+void Viewer::ClearPyramid ()
+{
+  ClearTiles ();
+  
+  for (unsigned i = 0; i < levels.size(); ++i)
+    if (levels[i] != image)
+      delete levels[i];
+  levels.clear ();
+  pyramid_changed = pyramid_failed = false;
+}
+
+bool Viewer::ImageReady ()
+{
+  pthread_mutex_lock (&pyramid_mutex);
+  const bool ready = !levels.empty();
+  pthread_mutex_unlock (&pyramid_mutex);
+  return ready;
+}
+
+void Viewer::PublishLevel (Image* level)
+{
+  pthread_mutex_lock (&pyramid_mutex);
+  levels.push_back (level);
+  pyramid_changed = true;
+  pthread_mutex_unlock (&pyramid_mutex);
+}
+
+void* Viewer::BuildPyramid (void* arg)
+{
+  Viewer* self = (Viewer*) arg;
+  Image* image = self->image;
   
-  evas_data = (uint8_t*)realloc(evas_data, image->w * image->h * 4);
-  uint8_t* src_data = image->getRawData();
-  const unsigned src_stride = image->stride();
-  const unsigned dst_stride = image->w * 4;
-  const int spp = image->spp; 
+  // decode, unless done already, and convert to what Evas displays
+  if (image->bps == 16)
+    colorspace_16_to_8 (*image);
   
-  for (int y = 0; y < image->h; ++y) {
-    uint8_t* src_ptr = src_data + y * src_stride;
-    uint8_t* dest_ptr = evas_data + y * dst_stride;
-    
-    if (channel == 0) {
-      for (int x = 0; x < image->w; ++x, dest_ptr +=4, src_ptr += spp) {
-	if (!Exact::NativeEndianTraits::IsBigendian) {
-	  dest_ptr[0] = src_ptr[2];
-	  dest_ptr[1] = src_ptr[1];
-	  dest_ptr[2] = src_ptr[0];
-	  if (spp == 4)
-	    dest_ptr[3] = src_ptr[3]; // alpha
-	}
-	else {
-	  dest_ptr[1] = src_ptr[0];
-	  dest_ptr[2] = src_ptr[1];
-	  dest_ptr[3] = src_ptr[2];
-	  if (spp == 4)
-	    dest_ptr[0] = src_ptr[3]; // alpha
-	}
+  // convert any gray to RGB
+  if (image->spp == 1)
+    colorspace_grayX_to_rgb8 (*image);
+  
+  if (!image->getRawData()) {
+    cerr << "image data not loaded?"<< endl;
+    pthread_mutex_lock (&self->pyramid_mutex);
+    self->pyramid_failed = true;
+    pthread_mutex_unlock (&self->pyramid_mutex);
+    return 0;
+  }
+  
+  // box reduced by half down to about a tile, each shown as soon as it
+  // exists, the image itself last, so zoomed out views never tile the
+  // full image just to replace it with a coarser level moments later
+  Image* level = image;
+  while (level->w > tile_size || level->h > tile_size) {
+    Image* reduced = new Image (*level);
+    thumbnail_scale (*reduced, .5, .5);
+    if (reduced->w <= 0 || reduced->h <= 0 ||
+	reduced->bps != 8 || (reduced->spp != 3 && reduced->spp != 4)) {
+      delete reduced;
+      break;
+    }
+    self->PublishLevel (reduced);
+    level = reduced;
+  }
+  self->PublishLevel (image);
+  
+  return 0;
+}
+
+void Viewer::UpdateTiles (bool rebuild)
+{
+  std::vector<Image*> available;
+  pthread_mutex_lock (&pyramid_mutex);
+  available = levels;
+  pyramid_changed = false;
+  pthread_mutex_unlock (&pyramid_mutex);
+  
+  if (available.empty() && preview)
+    available.push_back (preview);
+  if (available.empty() || view_w <= 0 || view_h <= 0)
+    return;
+  
+  // the least detailed level not smaller than the zoom, or the most detailed
+  Image* level = 0;
+  Image* detailed = available[0];
+  for (unsigned i = 0; i < available.size(); ++i) {
+    if (available[i]->w > detailed->w)
+      detailed = available[i];
+    if ((long long)available[i]->w * 100 >= (long long)image_w * zoom &&
+	(long long)available[i]->h * 100 >= (long long)image_h * zoom &&
+	(!level || available[i]->w < level->w))
+      level = available[i];
+  }
+  if (!level)
+    level = detailed;
+  
+  if (rebuild || level != tiles_level) {
+    ClearTiles ();
+    tiles_level = level;
+  }
+  if (preview && level != preview) {
+    delete preview; preview = 0;
+  }
+  
+  // the visible tiles
+  const long long vx = view_x, vy = view_y;
+  const long long ow = evas->OutputWidth(), oh = evas->OutputHeight();
+  const int tx1 = std::max (0LL, -vx * level->w / view_w) / tile_size;
+  const int ty1 = std::max (0LL, -vy * level->h / view_h) / tile_size;
+  const int tx2 = std::min ((long long)level->w - 1,
+			    (ow - vx) * level->w / view_w) / tile_size;
+  const int ty2 = std::min ((long long)level->h - 1,
+			    (oh - vy) * level->h / view_h) / tile_size;
+  
+  // drop the ones scrolled out, to only keep the visible ones in memory
+  for (tiles_t::iterator it = tiles.begin(); it != tiles.end();) {
+    const int tx = it->first & 0xffffffff, ty = it->first >> 32;
+    if (tx < tx1 || tx > tx2 || ty < ty1 || ty > ty2) {
+      delete it->second.eimage;
+      free (it->second.data);
+      tiles.erase (it++);
+    }
+    else
+      ++it;
+  }
+  
+  for (int ty = ty1; ty <= ty2; ++ty)
+    for (int tx = tx1; tx <= tx2; ++tx) {
+      const unsigned long long key = ((unsigned long long)ty << 32) | tx;
+      tiles_t::iterator it = tiles.find (key);
+      if (it == tiles.end())
+	it = tiles.insert (std::make_pair (key, NewTile (level, tx, ty))).first;
+      PlaceTile (it->second, level, tx, ty);
+    }
+}
+
+void Viewer::ClearTiles ()
+{
+  for (tiles_t::iterator it = tiles.begin(); it != tiles.end(); ++it) {
+    delete it->second.eimage;
+    free (it->second.data);
+  }
+  tiles.clear ();
+  tiles_level = 0;
+}
+
+// to Evas' native 32 bit ARGB, with the selected channel filter
+static void RowToEvas (const uint8_t* src_ptr, uint8_t* dest_ptr,
+		       int w, int spp, int channel)
+{
+  if (channel == 0) {
+    for (int x = 0; x < w; ++x, dest_ptr +=4, src_ptr += spp) {
+      if (!Exact::NativeEndianTraits::IsBigendian) {
+	dest_ptr[0] = src_ptr[2];
+	dest_ptr[1] = src_ptr[1];
+	dest_ptr[2] = src_ptr[0];
+	if (spp == 4)
+	  dest_ptr[3] = src_ptr[3]; // alpha
+      }
+      else {
+	dest_ptr[1] = src_ptr[0];
+	dest_ptr[2] = src_ptr[1];
+	dest_ptr[3] = src_ptr[2];
+	if (spp == 4)
+	  dest_ptr[0] = src_ptr[3]; // alpha
       }
     }
-    else { // channel
-      bool intensity = channel > 3;
-      int ch = (channel-1) % 3;
-      
-      for (int x=0; x < image->w; ++x, dest_ptr +=4, src_ptr += spp) {
-	if (!Exact::NativeEndianTraits::IsBigendian) {
-	  dest_ptr[0] = dest_ptr[1] = dest_ptr[2] = intensity ? src_ptr[ch] : 0;
-	  if (!intensity)
-	    dest_ptr[2-ch] = src_ptr[ch];
-	}
-	else {
-	  dest_ptr[1] = dest_ptr[2] = dest_ptr[3] = intensity ? src_ptr[ch] : 0;
-	  if (!intensity)
-	    dest_ptr[1+ch] = src_ptr[ch];
-	}
+  }
+  else { // channel
+    bool intensity = channel > 3;
+    int ch = (channel-1) % 3;
+    
+    for (int x=0; x < w; ++x, dest_ptr +=4, src_ptr += spp) {
+      if (!Exact::NativeEndianTraits::IsBigendian) {
+	dest_ptr[0] = dest_ptr[1] = dest_ptr[2] = intensity ? src_ptr[ch] : 0;
+	if (!intensity)
+	  dest_ptr[2-ch] = src_ptr[ch];
+      }
+      else {
+	dest_ptr[1] = dest_ptr[2] = dest_ptr[3] = intensity ? src_ptr[ch] : 0;
+	if (!intensity)
+	  dest_ptr[1+ch] = src_ptr[ch];
       }
     }
   }
+}
+
+Viewer::Tile Viewer::NewTile (Image* level, int tx, int ty)
+{
+  const int x0 = tx * tile_size, y0 = ty * tile_size;
+  const int w = std::min (tile_size, level->w - x0);
+  const int h = std::min (tile_size, level->h - y0);
+  const int spp = level->spp;
+  
+  Tile tile;
+  tile.data = (uint8_t*) malloc (w * h * 4);
+  const uint8_t* src_data = level->getRawData() + y0 * level->stride() + x0 * spp;
+  for (int y = 0; y < h; ++y)
+    RowToEvas (src_data + y * level->stride(), tile.data + y * w * 4,
+	       w, spp, channel);
+  
+  tile.eimage = new EvasImage (*evas);
+  tile.eimage->SmoothScale (smooth);
+  tile.eimage->Layer (1);
+  tile.eimage->Alpha (spp == 4);
+  tile.eimage->ImageSize (w, h);
+  tile.eimage->SetData (tile.data);
+  tile.eimage->DataUpdateAdd (0, 0, w, h);
+  tile.eimage->Show ();
   
-  eimage->Alpha (spp == 4);
-  eimage->Resize (image->w, image->h);
-  eimage->ImageSize (image->w, image->h);
-  eimage->ImageFill (0, 0, image->w, image->h);
-  eimage->SetData (evas_data);
-  eimage->DataUpdateAdd (0, 0, image->w, image->h);
-  eimage->Show ();
+  return tile;
+}
+
+void Viewer::PlaceTile (Tile& tile, Image* level, int tx, int ty)
+{
+  // from the next tile's edge, to not leave gaps when scaled
+  const int x0 = view_x + (long long)tx * tile_size * view_w / level->w;
+  const int y0 = view_y + (long long)ty * tile_size * view_h / level->h;
+  const int x1 = view_x + (long long)std::min ((tx + 1) * tile_size, level->w) * view_w / level->w;
+  const int y1 = view_y + (long long)std::min ((ty + 1) * tile_size, level->h) * view_h / level->h;
   
-  return eimage;
+  tile.eimage->Move (x0, y0);
+  tile.eimage->Resize (x1 - x0, y1 - y0);
+  tile.eimage->ImageFill (0, 0, x1 - x0, y1 - y0);
 }
 
 Viewer* __attribute__ ((weak)) createViewer(const std::vector<std::string>& args)
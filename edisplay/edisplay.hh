@@ -29,20 +29,28 @@
 
 #include <string>
 #include <vector>
+#include <map>
+
+#include <pthread.h>
 
 class Viewer {
 public:
   
   Viewer(const std::vector<std::string>& _images)
-    : images(_images), evas_data(0), zoom(100), evas_image(0) {
+    : images(_images), preview(0), tiles_level(0),
+      pyramid_running(false), pyramid_changed(false), pyramid_failed(false),
+      failed_loads(0),
+      view_x(0), view_y(0), view_w(0), view_h(0), image_w(0), image_h(0),
+      zoom(100), smooth(false) {
     it = images.begin();
     image = new Image;
+    pthread_mutex_init (&pyramid_mutex, 0);
   }
   
   virtual ~Viewer() {
-    if (evas_data) {
-      free (evas_data); evas_data = 0;
-    }
+    FinishPyramid ();
+    ClearPyramid ();
+    pthread_mutex_destroy (&pyramid_mutex);
     delete (image); image = 0;
   }
   
@@ -55,7 +63,18 @@ public:
 protected:
   
   void ImageToEvas ();
-  EvasImage* ImageToEvas (Image*, EvasImage* = 0);
+  
+  // multi-resolution tile pyramid, built asynchronously on load
+  void StartPyramid ();
+  void FinishPyramid ();
+  void ClearPyramid ();
+  static void* BuildPyramid (void* arg);
+  void PublishLevel (Image* level);
+  
+  bool ImageReady ();
+  
+  void UpdateTiles (bool rebuild = false);
+  void ClearTiles ();
   
   void Zoom (double factor);
   void Move (int _x, int _y);
@@ -71,6 +90,9 @@ protected:
   
   virtual void ImageLoaded () {};
   virtual void ImageClicked (unsigned int x, unsigned int y, int button) {};
+  // called for every key before the built-in bindings, while the pyramid
+  // may still be built: implementations touching the pixels of the image
+  // must FinishPyramid() first
   virtual bool ImageKey(KeySym keysym) { return false; };
   
 private:
@@ -81,7 +103,36 @@ private:
 protected:
   Image* image;
 private:
-  uint8_t* evas_data;
+  
+  // the image is shown in tiles of the pyramid level that is closest to,
+  // but not smaller than the zoom; the image itself is the most
+  // detailed level, each further one box reduced by half, the preview
+  // a quick, reduced decode
+  struct Tile {
+    EvasImage* eimage;
+    uint8_t* data;
+  };
+  typedef std::map<unsigned long long, Tile> tiles_t;
+  
+  Tile NewTile (Image* level, int tx, int ty);
+  void PlaceTile (Tile& tile, Image* level, int tx, int ty);
+  
+  std::vector<Image*> levels; // published, coarsest first, the image last
+  Image* preview;
+  tiles_t tiles;
+  Image* tiles_level;
+  
+  pthread_t pyramid_thread;
+  pthread_mutex_t pyramid_mutex;
+  bool pyramid_running;
+  bool pyramid_changed; // new level published, under the mutex
+  bool pyramid_failed; // the image could not be decoded, likewise
+  unsigned failed_loads; // consecutive failed deferred decodes
+  
+  // image geometry in the window, and the full image size, as the
+  // image itself is only accessed once the pyramid thread is finished
+  Evas_Coord view_x, view_y, view_w, view_h;
+  int image_w, image_h;
   
   // on screen display
   EvasRectangle* evas_osd_rect;
@@ -91,6 +142,7 @@ private:
   
   float HiDPI;
   int zoom;
+  bool smooth;
   int channel;
   
   // X11 stuff
@@ -102,7 +154,6 @@ private:
   
   // evas
   EvasCanvas* evas;
-  EvasImage* evas_image;
   EvasImage* evas_bgr_image;
   
 protected:
@@ -76,9 +76,18 @@ int main (int argc, char* argv[])
        file != filenames.end ();
        ++file)
     {
+      std::string filename = *file;
+      std::string cod = ImageCodec::getCodec (filename);
+      std::istream* input = &std::cin;
+      if (filename != "-")
+	input = new std::ifstream (filename.c_str(), std::ios::in | std::ios::binary);
+      
+      // decode the next page while the current one is encoded
+      ImageCodec* reader = ImageCodec::MultiRead (input, cod, "readahead");
+      
       for (int i = 0, n = 1; i < n; ++i)
       {
-        int ret = ImageCodec::Read (*file, image, "", i);
+        int ret = reader->Read (image);
 	if (ret == 0) {
 	  std::cerr << "Error reading " << *file << std::endl;
 	  ++errors;
@@ -90,6 +99,9 @@ int main (int argc, char* argv[])
 	  codec->Write (image, 75, ""/*compression*/, tiff_page++);
         }
       }
+      delete reader;
+      if (input != &std::cin)
+	delete input;
     }
   
   delete(codec); codec = 0;
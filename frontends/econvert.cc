@@ -65,6 +65,8 @@
 
 #include "api/api.cc"
 
+#include "profile.hh"
+
 #include "C.h"
 
 #include <functional>
@@ -118,6 +120,31 @@ Argument<std::string> arg_font ("", "font",
 				0, 1, true, true);
 #endif
 
+// to profile each operation, the argument callbacks are wrapped
+template <typename T, bool (*F)(const Argument<T>&)>
+struct profiled
+{
+  static const char* name;
+  
+  static bool callback (const Argument<T>& arg)
+  {
+    if (!profile_enabled())
+      return F(arg);
+    
+    profile_begin (name);
+    bool ret = F(arg);
+    profile_end ();
+    return ret;
+  }
+};
+
+template <typename T, bool (*F)(const Argument<T>&)>
+const char* profiled<T, F>::name = 0;
+
+// strip the convert_ prefix for a readable operation name
+#define PROFILED(T, f) \
+  (profiled<T, f>::name = #f + strlen("convert_"), profiled<T, f>::callback)
+
 bool convert_input (const Argument<std::string>& arg)
 {
   Image* image = 0;
@@ -141,15 +168,18 @@ bool convert_input (const Argument<std::string>& arg)
       if (arg_decompression.Size())
 	decompression = arg_decompression.Get();
       
+      // one open decoder for all images, not re-seeked per index
+      ImageCodec* reader = ImageCodec::MultiRead(&stream, cod, decompression);
       for (int i = 0, n = 1; i < n; ++i)
 	{
 	  if (!image)
 	    image = new Image;
 
-	  int ret = ImageCodec::Read(&stream, *image, cod, decompression, i);
+	  int ret = reader->Read(*image);
 	  if (ret <= 0) {
 	    std::cerr << "Error reading input file " << arg.Get(j) << ", image: " << i << std::endl;
 	    delete image;
+	    delete reader;
 	    return false;
 	  }
 	  if (i == 0)
@@ -158,6 +188,7 @@ bool convert_input (const Argument<std::string>& arg)
 	  images.push_back(image);
 	  image = 0;
 	}
+      delete reader;
     }
 
   if (image) delete image;
@@ -167,13 +198,14 @@ bool convert_input (const Argument<std::string>& arg)
 
 bool convert_append (const Argument<std::string>& arg)
 {
-  Image* base = 0;
-  for (images_iterator it = images.begin(); it != images.end(); ++it) {
-    if (it == images.begin())
-      base = *it;
-    else
-      append(*base, **it);
-  }
+  if (images.empty())
+    return true;
+  
+  // all at once, not re-allocated per page
+  images_iterator it = images.begin();
+  Image* base = *it;
+  std::vector<Image*> others(++it, images.end());
+  append(*base, others);
   return true;
 }
 
@@ -341,13 +373,26 @@ bool parse_scale(const Argument<std::string>& arg, double& sx, double& sy, bool&
   return false;
 }
 
+// the method used by --scale, the best for the factor by default
+static std::string scale_filter;
+
+bool convert_scale_filter (const Argument<std::string>& arg)
+{
+  scale_filter = arg.Get();
+  return true;
+}
+
 bool convert_scale (const Argument<std::string>& arg)
 {
   bool fixed; double sx, sy;
   if (!parse_scale(arg, sx, sy, fixed)) {
     return false;
   }
-  FOR_ALL_IMAGES(scale,  sx, sy, fixed);
+  for (images_iterator it = images.begin(); it != images.end(); ++it)
+    if (!scale_by_name (**it, scale_filter, sx, sy, fixed)) {
+      std::cerr << "Unknown scale filter: '" << scale_filter << "'" << std::endl;
+      return false;
+    }
   return true;
 }
 
@@ -416,6 +461,28 @@ bool convert_bicubic_scale (const Argument<std::string>& arg)
   return true;
 }
 
+bool convert_lanczos_scale (const Argument<std::string>& arg)
+{
+  bool fixed; double sx, sy;
+  if (!parse_scale(arg, sx, sy, fixed)) {
+    std::cerr << "scale '" << arg.Get() << "' could not be parsed." << std::endl;
+    return false;
+  }
+  FOR_ALL_IMAGES(resample_scale, sx, sy, RESAMPLE_LANCZOS3, fixed);
+  return true;
+}
+
+bool convert_mitchell_scale (const Argument<std::string>& arg)
+{
+  bool fixed; double sx, sy;
+  if (!parse_scale(arg, sx, sy, fixed)) {
+    std::cerr << "scale '" << arg.Get() << "' could not be parsed." << std::endl;
+    return false;
+  }
+  FOR_ALL_IMAGES(resample_scale, sx, sy, RESAMPLE_MITCHELL, fixed);
+  return true;
+}
+
 bool convert_box_scale (const Argument<std::string>& arg)
 {
   bool fixed; double sx, sy;
@@ -571,6 +638,22 @@ bool convert_fast_auto_crop (const Argument<bool>& arg)
   return true;
 }
 
+bool convert_fast_auto_crop_borders (const Argument<std::string>& arg)
+{
+  int tolerance = 0, noise = 0;
+  // parse
+  
+  if (arg.Get().empty() ||
+      sscanf(arg.Get().c_str(), "%d,%d", &tolerance, &noise) >= 1)
+    {
+      FOR_ALL_IMAGES(fastAutoCrop, AUTO_CROP_ALL,
+		     std::max(tolerance, 0), std::max(noise, 0));
+      return true;
+    }
+  std::cerr << "Auto crop borders '" << arg.Get() << "' could not be parsed." << std::endl;
+  return false;
+}
+
 bool convert_invert (const Argument<bool>& arg)
 {
   FOR_ALL_IMAGES(invert);
@@ -865,14 +948,14 @@ int main (int argc, char* argv[])
 				   "input file or '-' for stdin, optionally prefixed with format:"
 				   "\n\t\te.g: jpg:- or raw:rgb8-dump",
                                    0, std::numeric_limits<int>::max(), true, true);
-  arg_input.Bind (convert_input);
+  arg_input.Bind (PROFILED(std::string, convert_input));
   arglist.Add (&arg_input);
   
   Argument<std::string> arg_output ("o", "output",
 				    "output file or '-' for stdout, optinally prefix with format:"
 				    "\n\t\te.g. jpg:- or raw:rgb8-dump",
 				    0, std::numeric_limits<int>::max(), true, true);
-  arg_output.Bind (convert_output);
+  arg_output.Bind (PROFILED(std::string, convert_output));
   arglist.Add (&arg_output);
 
   // TODO: more args for the stack?
@@ -880,7 +963,7 @@ int main (int argc, char* argv[])
 				   "append file or '-' for stdin, optionally prefixed with format:"
 				   "\n\t\te.g: jpg:- or raw:rgb8-dump",
                                    0, 1, true, true);
-  arg_append.Bind (convert_append);
+  arg_append.Bind (PROFILED(std::string, convert_append));
   arglist.Add (&arg_append);
 
   
@@ -892,203 +975,229 @@ int main (int argc, char* argv[])
   Argument<std::string> arg_split ("", "split",
 			   "filenames to save the images split in Y-direction into n parts",
 			   0, 1, true, true);
-  arg_split.Bind (convert_split);
+  arg_split.Bind (PROFILED(std::string, convert_split));
   arglist.Add (&arg_split);
   
   Argument<std::string> arg_colorspace ("", "colorspace",
 					"convert image colorspace (BW, BILEVEL, GRAY, GRAY1, GRAY2, GRAY4,\n\t\tRGB, YUV, CYMK)",
 					0, 1, true, true);
-  arg_colorspace.Bind (convert_colorspace);
+  arg_colorspace.Bind (PROFILED(std::string, convert_colorspace));
   arglist.Add (&arg_colorspace);
 
   Argument<bool> arg_normalize ("", "normalize",
 				"transform the image to span the full color range",
 				0, 0, true, true);
-  arg_normalize.Bind (convert_normalize);
+  arg_normalize.Bind (PROFILED(bool, convert_normalize));
   arglist.Add (&arg_normalize);
 
   Argument<double> arg_brightness ("", "brightness",
 				   "change image brightness",
 				   0.0, 0, 1, true, true);
-  arg_brightness.Bind (convert_brightness);
+  arg_brightness.Bind (PROFILED(double, convert_brightness));
   arglist.Add (&arg_brightness);
 
   Argument<double> arg_contrast ("", "contrast",
 				 "change image contrast",
 				 0.0, 0, 1, true, true);
-  arg_contrast.Bind (convert_contrast);
+  arg_contrast.Bind (PROFILED(double, convert_contrast));
   arglist.Add (&arg_contrast);
 
   Argument<double> arg_gamma ("", "gamma",
 				 "change image gamma",
 				 0.0, 0, 1, true, true);
-  arg_gamma.Bind (convert_gamma);
+  arg_gamma.Bind (PROFILED(double, convert_gamma));
   arglist.Add (&arg_gamma);
 
   Argument<double> arg_hue ("", "hue",
 				 "change image hue",
 				 0.0, 0, 1, true, true);
-  arg_hue.Bind (convert_hue);
+  arg_hue.Bind (PROFILED(double, convert_hue));
   arglist.Add (&arg_hue);
 
   Argument<double> arg_saturation ("", "saturation",
 				   "change image saturation",
 				   0.0, 0, 1, true, true);
-  arg_saturation.Bind (convert_saturation);
+  arg_saturation.Bind (PROFILED(double, convert_saturation));
   arglist.Add (&arg_saturation);
 
   Argument<double> arg_lightness ("", "lightness",
 				  "change image lightness",
 				  0.0, 0, 1, true, true);
-  arg_lightness.Bind (convert_lightness);
+  arg_lightness.Bind (PROFILED(double, convert_lightness));
   arglist.Add (&arg_lightness);
 
   Argument<double> arg_blur ("", "blur",
 				 "gaussian blur",
 				 0.0, 0, 1, true, true);
-  arg_blur.Bind (convert_blur);
+  arg_blur.Bind (PROFILED(double, convert_blur));
   arglist.Add (&arg_blur);
 
   
+  Argument<std::string> arg_scale_filter ("", "scale-filter",
+				      "method used by the following --scale: auto, nearest, box,\n\t\t"
+				      "bilinear, bicubic, lanczos or mitchell, the default is auto",
+				      0, 1, true, true);
+  arg_scale_filter.Bind (PROFILED(std::string, convert_scale_filter));
+  arglist.Add (&arg_scale_filter);
+  
   Argument<std::string> arg_scale ("", "scale",
 			      "scale image data using a method suitable for specified factor",
 			      0, 1, true, true);
-  arg_scale.Bind (convert_scale);
+  arg_scale.Bind (PROFILED(std::string, convert_scale));
   arglist.Add (&arg_scale);
   
   Argument<std::string> arg_nearest_scale ("", "nearest-scale",
 				   "scale image data to nearest neighbour",
 				   0, 1, true, true);
-  arg_nearest_scale.Bind (convert_nearest_scale);
+  arg_nearest_scale.Bind (PROFILED(std::string, convert_nearest_scale));
   arglist.Add (&arg_nearest_scale);
 
   Argument<std::string> arg_bilinear_scale ("", "bilinear-scale",
 				       "scale image data with bi-linear filter",
 				       0, 1, true, true);
-  arg_bilinear_scale.Bind (convert_bilinear_scale);
+  arg_bilinear_scale.Bind (PROFILED(std::string, convert_bilinear_scale));
   arglist.Add (&arg_bilinear_scale);
 
   Argument<std::string> arg_bicubic_scale ("", "bicubic-scale",
 				      "scale image data with bi-cubic filter",
 				      0, 1, true, true);
-  arg_bicubic_scale.Bind (convert_bicubic_scale);
+  arg_bicubic_scale.Bind (PROFILED(std::string, convert_bicubic_scale));
   arglist.Add (&arg_bicubic_scale);
 
+  Argument<std::string> arg_lanczos_scale ("", "lanczos-scale",
+				      "scale image data with Lanczos-3 filter",
+				      0, 1, true, true);
+  arg_lanczos_scale.Bind (PROFILED(std::string, convert_lanczos_scale));
+  arglist.Add (&arg_lanczos_scale);
+
+  Argument<std::string> arg_mitchell_scale ("", "mitchell-scale",
+				      "scale image data with Mitchell-Netravali filter",
+				      0, 1, true, true);
+  arg_mitchell_scale.Bind (PROFILED(std::string, convert_mitchell_scale));
+  arglist.Add (&arg_mitchell_scale);
+
   Argument<std::string> arg_ddt_scale ("", "ddt-scale",
 				      "scale image data with data dependent triangulation",
 				     0, 1, true, true);
-  arg_ddt_scale.Bind (convert_ddt_scale);
+  arg_ddt_scale.Bind (PROFILED(std::string, convert_ddt_scale));
   arglist.Add (&arg_ddt_scale);
   
   Argument<std::string> arg_box_scale ("", "box-scale",
 				   "(down)scale image data with box filter",
 				  0, 1, true, true);
-  arg_box_scale.Bind (convert_box_scale);
+  arg_box_scale.Bind (PROFILED(std::string, convert_box_scale));
   arglist.Add (&arg_box_scale);
 
   Argument<std::string> arg_thumbnail_scale ("", "thumbnail",
 					"quick and dirty down-scale for a thumbnail",
 					0, 1, true, true);
-  arg_thumbnail_scale.Bind (convert_thumbnail_scale);
+  arg_thumbnail_scale.Bind (PROFILED(std::string, convert_thumbnail_scale));
   arglist.Add (&arg_thumbnail_scale);
 
    Argument<double> arg_rotate ("", "rotate",
 			       "rotation angle",
 			       0, 1, true, true);
-  arg_rotate.Bind (convert_rotate);
+  arg_rotate.Bind (PROFILED(double, convert_rotate));
   arglist.Add (&arg_rotate);
 
   Argument<double> arg_convolve ("", "convolve",
 			       "convolution matrix",
 			       0, 9999, true, true);
-  arg_convolve.Bind (convert_convolve);
+  arg_convolve.Bind (PROFILED(double, convert_convolve));
   arglist.Add (&arg_convolve);
 
   Argument<bool> arg_flip ("", "flip",
 			   "flip the image vertically",
 			   0, 0, true, true);
-  arg_flip.Bind (convert_flip);
+  arg_flip.Bind (PROFILED(bool, convert_flip));
   arglist.Add (&arg_flip);
 
   Argument<bool> arg_flop ("", "flop",
 			   "flip the image horizontally",
 			   0, 0, true, true);
-  arg_flop.Bind (convert_flop);
+  arg_flop.Bind (PROFILED(bool, convert_flop));
   arglist.Add (&arg_flop);
 
   Argument<int> arg_floyd ("", "floyd-steinberg",
 			   "Floyd Steinberg dithering using n shades",
 			   0, 1, true, true);
-  arg_floyd.Bind (convert_dither_floyd_steinberg);
+  arg_floyd.Bind (PROFILED(int, convert_dither_floyd_steinberg));
   arglist.Add (&arg_floyd);
   
   Argument<int> arg_riemersma ("", "riemersma",
 			       "Riemersma dithering using n shades",
 			       0, 1, true, true);
-  arg_riemersma.Bind (convert_dither_riemersma);
+  arg_riemersma.Bind (PROFILED(int, convert_dither_riemersma));
   arglist.Add (&arg_riemersma);
 
 
   Argument<bool> arg_edge ("", "edge",
                            "edge detect filter",
 			   0, 0, true, true);
-  arg_edge.Bind (convert_edge);
+  arg_edge.Bind (PROFILED(bool, convert_edge));
   arglist.Add (&arg_edge);
 
 
   Argument<bool> arg_pop ("", "pop",
                            "pop image from stack",
                            0, 0, true, true);
-  arg_pop.Bind (convert_pop);
+  arg_pop.Bind (PROFILED(bool, convert_pop));
   arglist.Add (&arg_pop);
 
   
   Argument<std::string> arg_resolution ("", "resolution",
 					"set meta data resolution in dpi to x[xy] e.g. 200 or 200x400",
 					0, 1, true, true);
-  arg_resolution.Bind (convert_resolution);
+  arg_resolution.Bind (PROFILED(std::string, convert_resolution));
   arglist.Add (&arg_resolution);
 
   Argument<std::string> arg_size ("", "size",
 			      "width and height of raw images whose dimensions are unknown",
 			      0, 1, true, true);
-  arg_size.Bind (convert_size);
+  arg_size.Bind (PROFILED(std::string, convert_size));
   arglist.Add (&arg_size);
 
   Argument<std::string> arg_crop ("", "crop",
 			      "crop an area out of an image: x,y,w,h",
 			      0, 1, true, true);
-  arg_crop.Bind (convert_crop);
+  arg_crop.Bind (PROFILED(std::string, convert_crop));
   arglist.Add (&arg_crop);
 
   Argument<bool> arg_fast_auto_crop ("", "fast-auto-crop",
 				     "fast auto crop",
 				     0, 0, true, true);
-  arg_fast_auto_crop.Bind (convert_fast_auto_crop);
+  arg_fast_auto_crop.Bind (PROFILED(bool, convert_fast_auto_crop));
   arglist.Add (&arg_fast_auto_crop);
 
+  Argument<std::string> arg_fast_auto_crop_borders ("", "fast-auto-crop-borders",
+			      "fast auto crop of the solid borders on all sides: tolerance[,noise]\n\t\t"
+			      "e.g. 0 or 16,4",
+			      0, 1, true, true);
+  arg_fast_auto_crop_borders.Bind (PROFILED(std::string, convert_fast_auto_crop_borders));
+  arglist.Add (&arg_fast_auto_crop_borders);
+
   Argument<bool> arg_invert ("", "negate",
                              "negates the image",
                                0, 0, true, true);
-  arg_invert.Bind (convert_invert);
+  arg_invert.Bind (PROFILED(bool, convert_invert));
   arglist.Add (&arg_invert);
 
   Argument<bool> arg_deinterlace ("", "deinterlace",
 				  "shuffle every 2nd line",
 				  0, 0, true, true);
-  arg_deinterlace.Bind (convert_deinterlace);
+  arg_deinterlace.Bind (PROFILED(bool, convert_deinterlace));
   arglist.Add (&arg_deinterlace);
 
   Argument<std::string> arg_background ("", "background",
 					"background color used for operations",
 					0, 1, true, true);
-  arg_background.Bind (convert_background);
+  arg_background.Bind (PROFILED(std::string, convert_background));
   arglist.Add (&arg_background);
   
   Argument<std::string> arg_foreground ("", "foreground",
 					"foreground color used for operations",
 					0, 1, true, true);
-  arg_foreground.Bind (convert_foreground);
+  arg_foreground.Bind (PROFILED(std::string, convert_foreground));
   arglist.Add (&arg_foreground);
 
   arglist.Add (&arg_stroke_width);
@@ -1096,19 +1205,41 @@ int main (int argc, char* argv[])
   Argument<std::string> arg_line ("", "line",
                                   "draw a line: x1, y1, x2, y2",
                                    0, 1, true, true);
-  arg_line.Bind (convert_line);
+  arg_line.Bind (PROFILED(std::string, convert_line));
   arglist.Add (&arg_line);
 
 #if WITHFREETYPE == 1
   Argument<std::string> arg_text ("", "text",
                                   "draw text: x1, y1, height, text",
 				  0, 1, true, true);
-  arg_text.Bind (convert_text);
+  arg_text.Bind (PROFILED(std::string, convert_text));
   arglist.Add (&arg_text);
   arglist.Add (&arg_font);
   arglist.Add (&arg_text_rotation);
 #endif
   
+  Argument<bool> arg_profile ("", "profile",
+			       "print wall and CPU time, memory usage and whether the codec\n\t\t"
+			       "performed the operation for each operation on exit",
+			       0, 0, true, true);
+  arglist.Add (&arg_profile);
+  
+  Argument<bool> arg_profile_json ("", "profile-json",
+				   "as --profile, but print JSON",
+				   0, 0, true, true);
+  arglist.Add (&arg_profile_json);
+  
+  // the operations are executed while parsing, so enable profiling early
+  bool profile_json = false;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--profile") == 0)
+      profile_enable ();
+    else if (strcmp(argv[i], "--profile-json") == 0) {
+      profile_enable ();
+      profile_json = true;
+    }
+  }
+  
   // parse the specified argument list - and maybe output the Usage
   if (!arglist.Read (argc, argv)) {
     freeImages();
@@ -1132,5 +1263,8 @@ int main (int argc, char* argv[])
   
   // all is done inside the argument callback functions
   freeImages();
+  
+  if (profile_enabled())
+    profile_report (std::cerr, profile_json);
   return 0;
 }
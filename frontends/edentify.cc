@@ -91,8 +91,10 @@ int main (int argc, char* argv[])
        file != list.end(); ++file) {
     for (int i = 0, n = 1; i < n; ++i)
     {
-      int ret = ImageCodec::Read(*file, image,
-	                         arg_decompression.Size() > 0 ? arg_decompression.Get() : "", i);
+      // only the header is needed, unless partial decoding was requested
+      int ret = arg_decompression.Size() > 0 ?
+	ImageCodec::Read(*file, image, arg_decompression.Get(), i) :
+	ImageCodec::Probe(*file, image, i);
       if (ret < 1) {
 	std::cout << "edentify: unable to open image '" << *file << "'." << std::endl;
 	continue;
@@ -150,6 +152,9 @@ int main (int argc, char* argv[])
 		  std::cout << image.resolutionY() << " PixelsPerInch"; break;
 		case 'z': //   image depth
 		  std::cout << image.bps; break;
+		case 'C': //   compression
+		  std::cout << (image.getCompression().empty() ?
+				 "unknown" : image.getCompression()); break;
 		  // %D   image dispose method
 		  // %O   page offset
 		case 'P': //   page width and height
@@ -78,6 +78,15 @@ int main (int argc, char* argv[])
   Argument<double> arg_sd ("sd", "standard-deviation",
 			   "standard deviation for Gaussian distribution", 0.0, 0, 1);
 
+  Argument<std::string> arg_adaptive ("a", "adaptive",
+				      "local adaptive threshold: sauvola or niblack", 0, 1);
+  
+  Argument<int> arg_window ("w", "window",
+			    "adaptive threshold window size", 0, 0, 1);
+  
+  Argument<double> arg_k ("k", "k",
+			  "adaptive threshold sensitivity", 0.0, 0, 1);
+
   arg_help.Bind (usage);
   
   arglist.Add (&arg_help);
@@ -91,6 +100,9 @@ int main (int argc, char* argv[])
   arglist.Add (&arg_dpi);
   arglist.Add (&arg_sd);
   arglist.Add (&arg_denoise);
+  arglist.Add (&arg_adaptive);
+  arglist.Add (&arg_window);
+  arglist.Add (&arg_k);
 
   // parse the specified argument list - and maybe output the Usage
   if (!arglist.Read (argc, argv))
@@ -99,6 +111,19 @@ int main (int argc, char* argv[])
     }
   
   int errors = 0;
+  
+  bool adaptive = false;
+  adaptive_method_t method = ADAPTIVE_SAUVOLA;
+  if (arg_adaptive.Size()) {
+    adaptive = true;
+    if (arg_adaptive.Get() == "niblack")
+      method = ADAPTIVE_NIBLACK;
+    else if (arg_adaptive.Get() != "sauvola") {
+      std::cerr << "Unknown adaptive method: " << arg_adaptive.Get() << std::endl;
+      return 1;
+    }
+  }
+  
   ImageCodec* codec = 0;
   std::fstream* stream = 0;
   Image image;
@@ -191,8 +216,15 @@ int main (int argc, char* argv[])
 	  if (arg_threshold.Get() == 0)
 	    threshold = 200;
 	  
+	  // locally adaptive, directly yields the 1-bit data
+	  if (adaptive && image.bps > 1)
+	    {
+	      adaptive_threshold (image, method, arg_window.Get(), arg_k.Get());
+	      if (arg_denoise.Get())
+		std::cerr << "Denoise not applicable to adaptive threshold." << std::endl;
+	    }
 	  // denoise? only if more than 1bps in the source image
-	  if (arg_denoise.Get() && image.bps > 1)
+	  else if (arg_denoise.Get() && image.bps > 1)
 	    {
 	      colorspace_gray8_threshold (image, threshold);
 	      colorspace_gray8_denoise_neighbours (image);
@@ -25,6 +25,7 @@
 #include "ImageIterator2.hh"
 #include "Codecs.hh"
 #include "Colorspace.hh"
+#include "profile.hh"
 
 #include "Endianess.hh"
 
@@ -878,69 +879,84 @@ void colorspace_de_ieee (Image& image)
   }
 }
 
-void colorspace_de_palette (Image& image, int table_entries,
-			    uint16_t* rmap, uint16_t* gmap, uint16_t* bmap, uint16_t* amap)
+// true for a black, white (or inverted white, black) leading table
+static bool bw_table (uint16_t* rmap, uint16_t* gmap, uint16_t* bmap,
+		      bool inverted = false)
+{
+  const int b = inverted ? 1 : 0, w = inverted ? 0 : 1;
+  return rmap[b] == 0 && gmap[b] == 0 && bmap[b] == 0 &&
+    rmap[w] >= 0xff00 && gmap[w] >= 0xff00 && bmap[w] >= 0xff00;
+}
+
+// how colorspace_de_palette converts the table, shared with
+// colorspace_de_palette_format so probing and decoding agree
+enum palette_kind {
+  PALETTE_BW, // 1bps b/w, kept
+  PALETTE_BW_INVERTED, // 1bps, just inverted
+  PALETTE_ORDERED_GRAY, // index == gray value, kept
+  PALETTE_GRAY, // expanded to gray8
+  PALETTE_COLOR // expanded to RGB8 or RGBA8
+};
+
+static palette_kind classify_palette (int bps, int table_entries,
+				      uint16_t* rmap, uint16_t* gmap, uint16_t* bmap,
+				      uint16_t* amap)
 {
   // detect 1bps b/w tables
-  if (image.bps == 1 && table_entries >= 2 && !amap) {
-    if (rmap[0] == 0 &&
-	gmap[0] == 0 &&
-	bmap[0] == 0 &&
-	rmap[1] >= 0xff00 &&
-	gmap[1] >= 0xff00 &&
-	bmap[1] >= 0xff00)
-      {
-	//std::cerr << "correct b/w table." << std::endl;
-	return;
-      }
-    if (rmap[1] == 0 &&
-	gmap[1] == 0 &&
-	bmap[1] == 0 &&
-	rmap[0] >= 0xff00 &&
-	gmap[0] >= 0xff00 &&
-	bmap[0] >= 0xff00)
-      {
-	//std::cerr << "inverted b/w table." << std::endl;
-	for (uint8_t* it = image.getRawData();
-	     it < image.getRawDataEnd();
-	     ++it)
-	  *it ^= 0xff;
-	image.setRawData ();
-	return;
-      }
+  if (bps == 1 && table_entries >= 2 && !amap) {
+    if (bw_table (rmap, gmap, bmap))
+      return PALETTE_BW;
+    if (bw_table (rmap, gmap, bmap, true))
+      return PALETTE_BW_INVERTED;
   }
   
   // detect gray tables
-  bool is_gray = false;
-  if (table_entries > 1 && !amap) {
-    bool is_ordered_gray = (image.bps == 8 || image.bps == 4 ||
-			    image.bps == 2) && (1 << image.bps == table_entries);
-    is_gray = true;
-    
-    // std::cerr << (1 << image.bps) << " vs " << table_entries << std::endl;
-    
-    // std::cerr << "checking for gray table" << std::endl;
-    for (int i = 0; (is_gray || is_ordered_gray) && i < table_entries; ++i) {
-      // std::cerr << rmap[i] << " " << gmap[i] << " " << bmap[i] << std::endl;
-      if (rmap[i] >> 8 != gmap[i] >> 8 ||
-	  rmap[i] >> 8 != bmap[i] >> 8) {
-	is_gray = is_ordered_gray = false;
-      }
-      else if (is_ordered_gray) {
-	const int ref = i * 0xff / (table_entries - 1);
-	if (rmap[i] >> 8 != ref ||
-	    gmap[i] >> 8 != ref ||
-	    bmap[i] >> 8 != ref)
-	  is_ordered_gray = false;
-      }
+  if (table_entries <= 1 || amap)
+    return PALETTE_COLOR;
+  
+  bool is_ordered_gray = (bps == 8 || bps == 4 || bps == 2) &&
+    (1 << bps == table_entries);
+  bool is_gray = true;
+  
+  for (int i = 0; (is_gray || is_ordered_gray) && i < table_entries; ++i) {
+    if (rmap[i] >> 8 != gmap[i] >> 8 ||
+	rmap[i] >> 8 != bmap[i] >> 8) {
+      is_gray = is_ordered_gray = false;
     }
-    
-    // std::cerr << "gray: " << is_gray << ", is ordered: " << is_ordered_gray << std::endl;
-    
-    if (is_ordered_gray)
-      return;
+    else if (is_ordered_gray) {
+      const int ref = i * 0xff / (table_entries - 1);
+      if (rmap[i] >> 8 != ref)
+	is_ordered_gray = false;
+    }
+  }
+  
+  if (is_ordered_gray)
+    return PALETTE_ORDERED_GRAY;
+  return is_gray ? PALETTE_GRAY : PALETTE_COLOR;
+}
+
+void colorspace_de_palette (Image& image, int table_entries,
+			    uint16_t* rmap, uint16_t* gmap, uint16_t* bmap, uint16_t* amap)
+{
+  const palette_kind kind =
+    classify_palette (image.bps, table_entries, rmap, gmap, bmap, amap);
+  
+  switch (kind) {
+  case PALETTE_BW:
+  case PALETTE_ORDERED_GRAY:
+    return;
+  case PALETTE_BW_INVERTED:
+    for (uint8_t* it = image.getRawData();
+	 it < image.getRawDataEnd();
+	 ++it)
+      *it ^= 0xff;
+    image.setRawData ();
+    return;
+  default:
+    break;
   }
   
+  const bool is_gray = kind == PALETTE_GRAY;
   int new_size = image.w * image.h;
   if (amap)
     new_size *= 4; // RGBA, CMYK
@@ -1000,17 +1016,26 @@ void colorspace_de_palette (Image& image, int table_entries,
   image.setRawData(new_data);
 
   // special case, e.g. for 1-bit XPM
-  if (is_gray && table_entries == 2) {
-    if (rmap[0] == 0 &&
-        gmap[0] == 0 &&
-        bmap[0] == 0 &&
-        rmap[1] >= 0xff00 &&
-        gmap[1] >= 0xff00 &&
-        bmap[1] >= 0xff00)
-      {
-       	//std::cerr << "b/w after all." << std::endl;
-        colorspace_by_name(image, "bw");
-      }
+  if (is_gray && table_entries == 2 && bw_table (rmap, gmap, bmap))
+    colorspace_by_name(image, "bw");
+}
+
+void colorspace_de_palette_format (int& spp, int& bps, int table_entries,
+				   uint16_t* rmap, uint16_t* gmap, uint16_t* bmap, uint16_t* amap)
+{
+  switch (classify_palette (bps, table_entries, rmap, gmap, bmap, amap)) {
+  case PALETTE_BW:
+  case PALETTE_BW_INVERTED:
+  case PALETTE_ORDERED_GRAY:
+    spp = 1;
+    break;
+  case PALETTE_GRAY:
+    spp = 1;
+    bps = table_entries == 2 && bw_table (rmap, gmap, bmap) ? 1 : 8;
+    break;
+  default:
+    spp = amap ? 4 : 3;
+    bps = 8;
   }
 }
 
@@ -1052,8 +1077,10 @@ bool colorspace_convert(Image& image, int spp, int bps, uint8_t threshold)
   // thru the codec?
   if (!image.isModified() && image.getCodec())
     if (spp == 1 && bps >= 8)
-      if (image.getCodec()->toGray(image))
+      if (image.getCodec()->toGray(image)) {
+	profile_codec_fast_path ();
 	return true;
+      }
 
   // no image data, e.g. for loading raw images
   if (!image.getRawData()) {
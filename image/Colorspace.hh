@@ -73,6 +73,9 @@ void colorspace_de_ieee (Image& image);
 
 void colorspace_de_palette (Image& image, int table_entries,
 			    uint16_t* rmap, uint16_t* gmap, uint16_t* bmap, uint16_t* amap = 0);
+// the spp/bps colorspace_de_palette would produce for the given table
+void colorspace_de_palette_format (int& spp, int& bps, int table_entries,
+				   uint16_t* rmap, uint16_t* gmap, uint16_t* bmap, uint16_t* amap = 0);
 
 void colorspace_pack_line(Image& image, int dstline, int srcline);
 
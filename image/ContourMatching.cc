@@ -1,6 +1,8 @@
 #include <cmath>
 #include <algorithm>
 #include <iostream>
+#include <string.h>
+#include <stdint.h>
 
 #include "ContourMatching.hh"
 
@@ -37,6 +39,7 @@ LogoRepresentation::LogoRepresentation(Contours* logo_contours,
 				       double angle_step)
 {
   source=logo_contours;
+  owned_source=0;
   tolerance=max_avg_tolerance;
   shift=reduction_shift;
   rot_max=maximum_angle;
@@ -105,20 +108,142 @@ LogoRepresentation::LogoRepresentation(Contours* logo_contours,
 LogoRepresentation::~LogoRepresentation()
 {
   for (unsigned int s=0; s<logo_sets.size(); s++)
-    for (unsigned int j=0; j<logo_set_count; j++)
+    for (unsigned int j=0; j<logo_sets[s].size(); j++)
       delete logo_sets[s][j].contour;
+  delete owned_source;
 }
 
-double LogoRepresentation::Score(Contours* image)
+/* Binary representation format: a "LOGOREP v1" text line, followed by a
+   byte order mark and the data in native byte order, as the file is a
+   cache built where it is used. Contours are stored as their length
+   followed by the raw coordinate pairs, thus read with one fread each. */
+
+static const uint32_t logorep_bom=0x01020304;
+
+static bool WriteU32(FILE* f, uint32_t v)
 {
-  unsigned int image_set_count=image -> contours.size();
+  return fwrite(&v, sizeof(v), 1, f) == 1;
+}
 
-  if (image_set_count==0 || logo_set_count==0) {
-    std::cerr << "Warning: nothing to match..." << std::endl;
-    return 0.0;
+static bool WriteDouble(FILE* f, double v)
+{
+  return fwrite(&v, sizeof(v), 1, f) == 1;
+}
+
+static bool ReadU32(FILE* f, uint32_t& v)
+{
+  return fread(&v, sizeof(v), 1, f) == 1;
+}
+
+static bool ReadDouble(FILE* f, double& v)
+{
+  return fread(&v, sizeof(v), 1, f) == 1;
+}
+
+static bool WriteRawContour(FILE* f, const Contours::Contour& c)
+{
+  if (!WriteU32(f, c.size()))
+    return false;
+  return c.empty() || fwrite(&c[0], sizeof(c[0]), c.size(), f) == c.size();
+}
+
+static bool ReadRawContour(FILE* f, Contours::Contour& c)
+{
+  uint32_t l;
+  if (!ReadU32(f, l))
+    return false;
+  c.resize(l);
+  return l == 0 || fread(&c[0], sizeof(c[0]), l, f) == l;
+}
+
+bool LogoRepresentation::Write(FILE* f) const
+{
+  if (fprintf(f, "LOGOREP v1\n") < 0)
+    return false;
+
+  if (!WriteU32(f, logorep_bom) ||
+      !WriteU32(f, tolerance) || !WriteU32(f, shift) ||
+      !WriteU32(f, logo_set_count) || !WriteU32(f, total_contour_length) ||
+      !WriteU32(f, logo_sets.size()) ||
+      !WriteDouble(f, rot_max) || !WriteDouble(f, rot_step) ||
+      !WriteDouble(f, centerx) || !WriteDouble(f, centery))
+    return false;
+
+  // only the used logo contours, in feature order
+  for (unsigned int c=0; c<logo_set_count; c++)
+    if (!WriteRawContour(f, *(source->contours[logo_set_map[c]])))
+      return false;
+
+  for (unsigned int s=0; s<logo_sets.size(); s++)
+    for (unsigned int c=0; c<logo_set_count; c++) {
+      const LogoContourData& data=logo_sets[s][c];
+      if (!WriteDouble(f, data.rx) || !WriteDouble(f, data.ry) ||
+	  !WriteRawContour(f, *data.contour))
+	return false;
+    }
+
+  return true;
+}
+
+LogoRepresentation* LogoRepresentation::Read(FILE* f)
+{
+  char magic[16];
+  if (!fgets(magic, sizeof(magic), f) || strcmp(magic, "LOGOREP v1\n") != 0)
+    return 0;
+
+  LogoRepresentation* rep=new LogoRepresentation();
+  rep->owned_source=new Contours();
+  rep->source=rep->owned_source;
+
+  uint32_t bom, tolerance, shift, logo_set_count, total_length, set_count;
+  if (!ReadU32(f, bom) || bom != logorep_bom ||
+      !ReadU32(f, tolerance) || !ReadU32(f, shift) ||
+      !ReadU32(f, logo_set_count) || !ReadU32(f, total_length) ||
+      !ReadU32(f, set_count) ||
+      !ReadDouble(f, rep->rot_max) || !ReadDouble(f, rep->rot_step) ||
+      !ReadDouble(f, rep->centerx) || !ReadDouble(f, rep->centery)) {
+    delete rep;
+    return 0;
+  }
+  rep->tolerance=tolerance;
+  rep->shift=shift;
+  rep->logo_set_count=logo_set_count;
+  rep->total_contour_length=total_length;
+
+  std::vector <Contours::Contour*>& contours=rep->owned_source->contours;
+  contours.reserve(logo_set_count);
+  rep->logo_set_map.resize(logo_set_count);
+  for (unsigned int c=0; c<logo_set_count; c++) {
+    contours.push_back(new Contours::Contour());
+    rep->logo_set_map[c]=c;
+    if (!ReadRawContour(f, *contours.back())) {
+      delete rep;
+      return 0;
+    }
+  }
+
+  rep->logo_sets.reserve(set_count);
+  for (unsigned int s=0; s<set_count; s++) {
+    rep->logo_sets.push_back(std::vector <LogoContourData> (logo_set_count));
+    for (unsigned int c=0; c<logo_set_count; c++) {
+      LogoContourData& data=rep->logo_sets.back()[c];
+      data.contour=new Contours::Contour();
+      if (!ReadDouble(f, data.rx) || !ReadDouble(f, data.ry) ||
+	  !ReadRawContour(f, *data.contour)) {
+	delete rep;
+	return 0;
+      }
+    }
   }
 
-  // build image set
+  return rep;
+}
+
+void LogoRepresentation::PrepareImageSet(Contours* image, unsigned int shift,
+					 ImageSet& image_set)
+{
+  unsigned int image_set_count=image -> contours.size();
+
   image_set.resize(image_set_count);
   for (unsigned int c=0; c<image_set_count; c++) {
     ImageContourData& data=image_set[c];
@@ -129,6 +254,32 @@ double LogoRepresentation::Score(Contours* image)
 		      data.rx,
 		      data.ry);
   }
+}
+
+void LogoRepresentation::FreeImageSet(ImageSet& image_set)
+{
+  for (unsigned int j=0; j<image_set.size(); j++)
+    delete image_set[j].contour;
+  image_set.clear();
+}
+
+double LogoRepresentation::Score(Contours* image)
+{
+  ImageSet image_set;
+  PrepareImageSet(image, shift, image_set);
+  double score=Score(image, image_set);
+  FreeImageSet(image_set);
+  return score;
+}
+
+double LogoRepresentation::Score(Contours* image, const ImageSet& image_set)
+{
+  unsigned int image_set_count=image_set.size();
+
+  if (image_set_count==0 || logo_set_count==0) {
+    std::cerr << "Warning: nothing to match..." << std::endl;
+    return 0.0;
+  }
 
   // calculate 1 to 1 matching scores
 
@@ -248,10 +399,6 @@ double LogoRepresentation::Score(Contours* image)
 	delete logo_sets[s][j].matches[i];
       logo_sets[s][j].matches.clear();
     }
- 
-  for (unsigned int j=0; j<image_set_count; j++)
-    delete image_set[j].contour;
-  image_set.clear();
 
   return score;
 }
@@ -474,3 +621,50 @@ double LogoRepresentation::Match::TransScore(double tx, double ty)
 {
   return std::max(.0, score - 0.5*((double)length*(fabs(tx-transx)+fabs(ty-transy))));
 }
+
+
+class ResultSorter
+{
+public:
+  bool operator() (const LogoLibrary::Result& a, const LogoLibrary::Result& b)
+  {
+    return a.score > b.score;
+  }
+};
+
+const std::vector <LogoLibrary::Result>& LogoLibrary::Match(Contours* image, unsigned int k)
+{
+  const int n=logos.size();
+
+  // the image set of each distinct reduction shift, prepared only once
+  std::vector <unsigned int> shifts;
+  std::vector <LogoRepresentation::ImageSet> image_sets;
+  std::vector <unsigned int> set_of(n);
+  for (int i=0; i<n; i++) {
+    unsigned int shift=logos[i]->ReductionShift();
+    unsigned int s=std::find(shifts.begin(), shifts.end(), shift) - shifts.begin();
+    if (s == shifts.size()) {
+      shifts.push_back(shift);
+      image_sets.push_back(LogoRepresentation::ImageSet());
+      LogoRepresentation::PrepareImageSet(image, shift, image_sets.back());
+    }
+    set_of[i]=s;
+  }
+
+  results.resize(n);
+#pragma omp parallel for schedule (dynamic, 1)
+  for (int i=0; i<n; i++) {
+    results[i].logo=logos[i];
+    results[i].index=i;
+    results[i].score=logos[i]->Score(image, image_sets[set_of[i]]);
+  }
+
+  for (unsigned int s=0; s<image_sets.size(); s++)
+    LogoRepresentation::FreeImageSet(image_sets[s]);
+
+  std::stable_sort(results.begin(), results.end(), ResultSorter());
+  if (k && k < results.size())
+    results.resize(k);
+
+  return results;
+}
@@ -1,3 +1,5 @@
+#include <stdio.h> // FILE
+
 #include "ContourUtility.hh"
 
 class LogoRepresentation
@@ -14,8 +16,32 @@ public:
 
   ~LogoRepresentation();
 
+  // the fully precomputed representation (all rotated, reduced logo sets
+  // and the used logo contours) in a compact binary format, so workers do
+  // not need to recompute it on each start
+  bool Write(FILE* f) const;
+  // returns 0 on error, the representation owns its logo contours
+  static LogoRepresentation* Read(FILE* f);
+
   double Score(Contours* image);
 
+  // the image contours centered and reduced by a given shift, prepared
+  // once to score any number of representations with the same shift
+  struct ImageContourData
+  {
+    Contours::Contour* contour;
+    double rx;
+    double ry;
+  };
+  typedef std::vector <ImageContourData> ImageSet;
+
+  static void PrepareImageSet(Contours* image, unsigned int shift, ImageSet& image_set);
+  static void FreeImageSet(ImageSet& image_set);
+
+  // image_set must have been prepared from image with ReductionShift()
+  double Score(Contours* image, const ImageSet& image_set);
+  unsigned int ReductionShift() const { return shift; }
+
   // updated after call to score
   std::pair<int, int> logo_translation;
   double rot_angle;
@@ -28,6 +54,8 @@ public:
 protected:
   friend class MatchSorter;
 
+  LogoRepresentation() : owned_source(0) {} // for Read()
+
   double N_M_Match(unsigned int set, unsigned int& pivot);
   double PrecisionScore();
 
@@ -38,6 +66,7 @@ protected:
   bool Optimize(double& score);
 
   Contours* source;
+  Contours* owned_source; // loaded via Read()
   unsigned int tolerance;
   unsigned int shift;
   double rot_max;
@@ -58,13 +87,6 @@ protected:
     unsigned int n_to_n_match_index;
   };
 
-  struct ImageContourData
-  {
-    Contours::Contour* contour;
-    double rx;
-    double ry;
-  };
-
   class Match
   {
   public:
@@ -88,8 +110,33 @@ protected:
 
   std::vector < std::vector <LogoContourData> > logo_sets;
   std::vector < unsigned int > logo_set_map;
-
-  std::vector < ImageContourData > image_set;
 };
 
 
+// A set of logos matched against the contours of one image in one go:
+// the image contours are prepared only once per reduction shift, and the
+// logos are scored in parallel. The representations are not owned and
+// must be added only once; after Match() each holds its translation,
+// angle and mapping as after its own Score().
+class LogoLibrary
+{
+public:
+  void Add(LogoRepresentation* logo) { logos.push_back(logo); }
+  unsigned int Size() const { return logos.size(); }
+  LogoRepresentation* operator[](unsigned int i) { return logos[i]; }
+
+  struct Result
+  {
+    LogoRepresentation* logo;
+    unsigned int index; // as added
+    double score;
+  };
+
+  // the k best scoring logos (all for k == 0), best first
+  const std::vector <Result>& Match(Contours* image, unsigned int k=0);
+  const std::vector <Result>& Results() const { return results; }
+
+protected:
+  std::vector <LogoRepresentation*> logos;
+  std::vector <Result> results;
+};
@@ -18,6 +18,8 @@
 
 #include "Contours.hh"
 
+#include <algorithm>
+
 /*
  list of pixel traversals (clockwise order):
  0: on left side upwards
@@ -26,18 +28,6 @@
  3: on pixel bottom to the left
 */
 
-// bitmask for pixel traversal - first bit is there to indicate foreground pixel
-const unsigned int pixelborder[4]={2,4,8,16};
-
-struct StartCheck {
-  int dx;
-  int dy;
-};
-
-const StartCheck startchecks[4]={
-  {-1,0}, {0,-1}, {1,0}, {0,1}
-};
-
 struct Transition {
   int dx;
   int dy;
@@ -52,65 +42,234 @@ const Transition transitions[4][3]={
 };
 
 
-inline bool Step(Contours::VisitMap& map, int& x, int& y, int& border)
+/*
+ The foreground is kept as run-length encoded rows, instead of a
+ per-pixel visit map (4 bytes per pixel). The borders are followed with
+ the transitions above, probing the neighbours in the runs of the row.
+
+ Each border segment (pixel side towards the background) belongs to
+ exactly one closed contour, and every contour contains at least one
+ left side (border 0), which always is the left end of a run. Thus only
+ one visited flag per run is needed: each contour is traced once from
+ the first run whose left side it has not yet been seen on.
+
+ To yield the very same contours as the former column-wise pixel scan,
+ each contour is rotated to start at its minimal (x, y, border) segment,
+ where that scan found it, and the contours are sorted by that start.
+*/
+
+struct Run {
+  unsigned int x1, x2; // [x1, x2)
+  Run(unsigned int _x1, unsigned int _x2) : x1(_x1), x2(_x2) {}
+};
+
+typedef std::vector < std::vector <Run> > RunRows;
+
+struct RunMap {
+  int w, h;
+  RunRows rows;
+  std::vector <unsigned int> offset; // flat index of each row's first run
+  std::vector <unsigned int> hint; // last run found in each row
+
+  RunMap(int _w, int _h) : w(_w), h(_h), rows(_h), hint(_h, 0) {}
+
+  /* index of the run containing (x,y) in its row, or -1 for background;
+     as the tracer only moves one pixel at a time, the search walks from
+     the run last found in that row */
+  int find(int x, int y)
+  {
+    if (x < 0 || x >= w || y < 0 || y >= h)
+      return -1;
+    const std::vector <Run>& row=rows[y];
+    const unsigned int n=row.size();
+    if (n == 0)
+      return -1;
+    unsigned int r=hint[y];
+    while (r > 0 && row[r].x1 > (unsigned int)x)
+      --r;
+    while (r+1 < n && row[r+1].x1 <= (unsigned int)x)
+      ++r;
+    hint[y]=r;
+    if (row[r].x1 <= (unsigned int)x && (unsigned int)x < row[r].x2)
+      return r;
+    return -1;
+  }
+};
+
+// runs from the column-wise stored matrix, sweeping a column at a time
+static void BuildRuns(const FGMatrix& image, RunMap& map)
+{
+  std::vector <int> open(image.h, -1); // start of the open run of each row
+  for (unsigned int x=0; x<image.w; x++) {
+    const bool* column=image.data[x];
+    for (unsigned int y=0; y<image.h; y++)
+      if (column[y]) {
+	if (open[y] < 0)
+	  open[y]=x;
+      } else if (open[y] >= 0) {
+	map.rows[y].push_back(Run(open[y], x));
+	open[y]=-1;
+      }
+  }
+  for (unsigned int y=0; y<image.h; y++)
+    if (open[y] >= 0)
+      map.rows[y].push_back(Run(open[y], image.w));
+}
+
+// runs straight from the image, foreground as for FGMatrix: luminance < threshold
+static void BuildRuns(Image& image, unsigned int fg_threshold, RunMap& map)
+{
+  const int stride=image.stride();
+  const uint8_t* data=image.getRawData();
+
+#pragma omp parallel for schedule (dynamic, 16)
+  for (int y=0; y<image.h; y++) {
+    std::vector <Run>& row=map.rows[y];
+    int start=-1;
+
+    if (image.spp == 1 && image.bps == 1) {
+      // gray1: foreground is either the black or white bits (or all or none)
+      const bool fg0=0 < fg_threshold, fg1=255 < fg_threshold;
+      const uint8_t* src=data+y*stride;
+      for (int x=0; x<image.w; x++) {
+	// skip whole bytes of background
+	if ((x & 7) == 0 && start < 0 && x+8 <= image.w &&
+	    src[x/8] == (fg0 ? 0xff : 0x00) && fg0 != fg1) {
+	  x+=7;
+	  continue;
+	}
+	const bool bit=(src[x/8] >> (7 - (x & 7))) & 1;
+	const bool fg=bit ? fg1 : fg0;
+	if (fg) {
+	  if (start < 0)
+	    start=x;
+	} else if (start >= 0) {
+	  row.push_back(Run(start, x));
+	  start=-1;
+	}
+      }
+    } else if (image.spp == 1 && image.bps == 8) {
+      const uint8_t* src=data+y*stride;
+      for (int x=0; x<image.w; x++)
+	if (src[x] < fg_threshold) {
+	  if (start < 0)
+	    start=x;
+	} else if (start >= 0) {
+	  row.push_back(Run(start, x));
+	  start=-1;
+	}
+    } else {
+      Image::iterator it=image.begin();
+      it=it.at(0, y);
+      for (int x=0; x<image.w; x++, ++it)
+	if ((*it).getL() < fg_threshold) {
+	  if (start < 0)
+	    start=x;
+	} else if (start >= 0) {
+	  row.push_back(Run(start, x));
+	  start=-1;
+	}
+    }
+
+    if (start >= 0)
+      row.push_back(Run(start, image.w));
+  }
+}
+
+inline void Step(RunMap& map, std::vector <char>& visited,
+		 int& x, int& y, int& border)
 {
   for (unsigned int i=0; i<3; i++) {
     const Transition& t=transitions[border][i];
     const int xx=x+t.dx;
     const int yy=y+t.dy;
     // do we have a foreground pixel ?
-    if (xx >= 0 && xx < (signed int)map.w && yy >= 0 && yy < (signed int)map.h && map(xx,yy) > 0) {
-      if ((map(xx,yy) & pixelborder[t.border]) == 0) { // go there
-	x=xx;
-	y=yy;
-	border=t.border;
-	map(x,y) |= pixelborder[border];
-	return true;
-      } else // already been there before
-	return false;
+    const int run=map.find(xx,yy);
+    if (run >= 0) {
+      x=xx;
+      y=yy;
+      border=t.border;
+      if (border == 0) // the left end of this run
+	visited[map.offset[y]+run]=1;
+      return;
     }
   }
-
-  // note: this code line is never reached, because last transition is always {0,0,b}
-  return false;
 }
 
-inline bool Start(Contours::VisitMap& map, int x, int y, int border)
+struct TracedContour {
+  unsigned int x, y, border; // start segment
+  Contours::Contour* contour;
+
+  bool operator< (const TracedContour& other) const
+  {
+    if (x != other.x)
+      return x < other.x;
+    if (y != other.y)
+      return y < other.y;
+    return border < other.border;
+  }
+};
+
+static void Trace(RunMap& map, std::vector <Contours::Contour*>& contours)
 {
-  if ((map(x,y) & pixelborder[border]) == 0 ) {
-    const StartCheck& c=startchecks[border];
-    const int xx=x+c.dx;
-    const int yy=y+c.dy;
-    // do we have a background pixel ?
-    if (xx < 0 || xx >= (signed int)map.w || yy < 0 || yy >= (signed int)map.h || ((map(xx,yy) & 1) == 0)) {
-      map(x,y)|=pixelborder[border];
-      return true;
-    }
+  map.offset.resize(map.h);
+  unsigned int runs=0;
+  for (int y=0; y<map.h; y++) {
+    map.offset[y]=runs;
+    runs+=map.rows[y].size();
   }
-  return false;
+  std::vector <char> visited(runs, 0);
+
+  std::vector <TracedContour> traced;
+  for (int y=0; y<map.h; y++)
+    for (unsigned int r=0; r<map.rows[y].size(); r++) {
+      if (visited[map.offset[y]+r])
+	continue;
+      visited[map.offset[y]+r]=1;
+
+      const int sx=map.rows[y][r].x1;
+      const int sy=y;
+      int xx=sx;
+      int yy=sy;
+      int border=0;
+
+      TracedContour t;
+      t.x=sx; t.y=sy; t.border=0;
+      unsigned int start=0;
+      Contours::Contour* current=new Contours::Contour();
+      do {
+	const TracedContour here={(unsigned int)xx, (unsigned int)yy, (unsigned int)border, 0};
+	if (here < t) {
+	  t=here;
+	  start=current->size();
+	}
+	current->push_back(std::pair<unsigned int, unsigned int>(xx, yy));
+	Step(map, visited, xx, yy, border);
+      } while (xx != sx || yy != sy || border != 0);
+
+      std::rotate(current->begin(), current->begin()+start, current->end());
+      t.contour=current;
+      traced.push_back(t);
+    }
+
+  std::sort(traced.begin(), traced.end());
+  contours.reserve(contours.size()+traced.size());
+  for (unsigned int i=0; i<traced.size(); i++)
+    contours.push_back(traced[i].contour);
 }
 
 Contours::Contours(const FGMatrix& image)
 {
-  VisitMap map(image.w, image.h);
-  for (unsigned int x=0; x<map.w; x++)
-    for (unsigned int y=0; y<map.h; y++)
-      map(x,y)=(image(x,y)) ? 1 : 0;
+  RunMap map(image.w, image.h);
+  BuildRuns(image, map);
+  Trace(map, contours);
+}
 
-  for (unsigned int x=0; x<map.w; x++)
-    for (unsigned int y=0; y<map.h; y++)
-      if (map(x,y) > 0)
-	for (unsigned int border=0; border < 4; border++)
-	  if (Start(map,x,y,border)) {
-	    int xx=x;
-	    int yy=y;
-	    int bborder=border;
-	    Contour* current=new Contour();
-	    contours.push_back(current);
-	    do {
-	      current->push_back(std::pair<unsigned int, unsigned int>(xx, yy));
-	    } while (Step(map, xx, yy, bborder));
-	  }
+Contours::Contours(Image& image, unsigned int fg_threshold)
+{
+  RunMap map(image.w, image.h);
+  BuildRuns(image, fg_threshold, map);
+  Trace(map, contours);
 }
 
 Contours::~Contours()
@@ -126,43 +285,40 @@ MidContours::MidContours(const FGMatrix& image)
   Contour* current = new Contour();
   contours.push_back (current);
   
-  // thru the whole "image" in x-direction
+  // thru the whole "image" in x-direction, midpoints of the row runs
+  RunMap map(image.w, image.h);
+  BuildRuns(image, map);
   for (unsigned int y = 0; y < image.h; y++)
-    for (unsigned int x = 0; x < image.w; x++)
+    for (unsigned int r = 0; r < map.rows[y].size(); r++)
       {
-	// something?
-	if (image(x,y))
-	  {
-	      // search end of region of scanline
-	    const unsigned int x1 = x++;
-	    while (x < image.w && image(x,y))
-	      x++;
-	    
-	    // region [x1,x], midpoint mx:
-	    const unsigned int mx = (x1 + x) / 2;
-	    
-	    current->push_back(std::pair<unsigned int, unsigned int>(mx, y));
-	  }
+	// region [x1,x2), midpoint mx:
+	const Run& run = map.rows[y][r];
+	const unsigned int mx = (run.x1 + run.x2) / 2;
+	
+	current->push_back(std::pair<unsigned int, unsigned int>(mx, y));
       }
   
-  // thru the whole "image" in x-direction
+  // thru the whole "image" in y-direction, the columns are contiguous
   for (unsigned int x = 0; x < image.w; x++)
-    for (unsigned int y = 0; y < image.h; y++)
-      {
-	// something?
-	if (image(x,y))
-	  {
-	    // search end of region of scanline
-	    const unsigned int y1 = y++;
-	    while (y < image.h && image(x,y))
-	      y++;
-	    
-	    // region [y1,y], midpoint mx:
-	    const unsigned int my = (y1 + y) / 2;
+    {
+      const bool* column = image.data[x];
+      for (unsigned int y = 0; y < image.h; y++)
+	{
+	  // something?
+	  if (column[y])
+	    {
+	      // search end of region of scanline
+	      const unsigned int y1 = y++;
+	      while (y < image.h && column[y])
+		y++;
 	      
-	    current->push_back(std::pair<unsigned int, unsigned int>(x, my));
-	  }
-      }
+	      // region [y1,y], midpoint my:
+	      const unsigned int my = (y1 + y) / 2;
+	      
+	      current->push_back(std::pair<unsigned int, unsigned int>(x, my));
+	    }
+	}
+    }
   
   // TODO: filter duplicates and/or clean spots without neighbour
   // TODO: sub-pixel accuracy would help
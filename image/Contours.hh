@@ -31,6 +31,8 @@ public:
   typedef std::vector<Contour*>::iterator iterator;
 
   Contours(const FGMatrix& image);
+  // directly from the image, foreground as for FGMatrix
+  Contours(Image& image, unsigned int fg_threshold);
   Contours() {} // empty constructor for generic usage
   
   void clear ();
@@ -14,12 +14,24 @@
  * 
  */
 
+#include <math.h>
+
+#include <vector>
+#include <algorithm>
+
 #include "Matrix.hh"
 #include "GaussianBlur.hh"
 
 void GaussianBlur(Image& image, double standard_deviation, int radius)
 {
   double sd = standard_deviation;
+  
+  // large kernels get slow, use the sd independent recursive version
+  if (radius <= 0 && sd >= recursive_gaussian_threshold && image.bps == 8) {
+    RecursiveGaussianBlur(image, sd);
+    return;
+  }
+  
   if (radius <= 0) {
     double thresh=1.0/255.0;
     double divisor=0.0;
@@ -35,7 +47,7 @@ void GaussianBlur(Image& image, double standard_deviation, int radius)
   // compute kernel (convolution matrix to move over the iamge)
   matrix_type divisor = 0;
     
-  matrix_type matrix[radius+1];
+  std::vector<matrix_type> matrix(radius+1);
 
   for (int d = 0; d <= radius; ++d) {
     matrix_type v = (matrix_type) (exp (-((float)d*d) / (2. * sd * sd)) );
@@ -51,5 +63,121 @@ void GaussianBlur(Image& image, double standard_deviation, int radius)
     matrix[i]*=divisor;
   }
     
-  decomposable_sym_convolution_matrix (image, matrix, matrix, radius, radius, 0.0);
+  decomposable_sym_convolution_matrix (image, &matrix[0], &matrix[0], radius, radius, 0.0);
+}
+
+/* Recursive (IIR) Gaussian approximation after Young and van Vliet,
+ * "Recursive implementation of the Gaussian filter", 1995: a causal
+ * and an anti-causal 3rd order pass per direction, thus the cost does
+ * not depend on the standard deviation. Like the convolution code
+ * above, which truncates the kernel at the borders, the image is zero
+ * extended, both passes run 3 sd into that border to settle before
+ * reaching the real data, thus both paths darken the borders alike.
+ */
+
+struct recursive_coefficients
+{
+  recursive_coefficients (double sd)
+  {
+    const double q = sd >= 2.5 ?
+      0.98711 * sd - 0.96330 :
+      3.97156 - 4.14554 * sqrt (1 - 0.26891 * sd);
+    const double q2 = q * q, q3 = q2 * q;
+    const double b0 = 1.57825 + 2.44413 * q + 1.4281 * q2 + 0.422205 * q3;
+    
+    b1 = (2.44413 * q + 2.85619 * q2 + 1.26661 * q3) / b0;
+    b2 = -(1.4281 * q2 + 1.26661 * q3) / b0;
+    b3 = 0.422205 * q3 / b0;
+    B = 1 - (b1 + b2 + b3);
+    pad = (int)ceil (3 * sd);
+  }
+  
+  float B, b1, b2, b3;
+  int pad;
+};
+
+// filters n elements of interleaved, independent channels, element
+// (i, c) is at data[i * step + c], buf must hold (n + 2 * pad + 6) * channels
+static void recursive_filter (const recursive_coefficients& k,
+			      uint8_t* data, int n, int step, int channels,
+			      float* buf)
+{
+  const int first = 3; // buf row of the element -pad
+  const int last = first + n + 2 * k.pad; // first trailing steady state row
+  
+  // leading steady state, of the zero border
+  for (int c = 0; c < 3 * channels; ++c)
+    buf[c] = 0;
+  
+  // causal
+  for (int i = first; i < last; ++i) {
+    const int j = i - first - k.pad;
+    float* w = buf + i * channels;
+    if (j < 0 || j >= n) {
+      for (int c = 0; c < channels; ++c)
+	w[c] = k.b1 * w[c - channels] +
+	  k.b2 * w[c - 2 * channels] + k.b3 * w[c - 3 * channels];
+      continue;
+    }
+    const uint8_t* src = data + j * step;
+    for (int c = 0; c < channels; ++c)
+      w[c] = k.B * src[c] + k.b1 * w[c - channels] +
+	k.b2 * w[c - 2 * channels] + k.b3 * w[c - 3 * channels];
+  }
+  
+  // trailing steady state, approximated by the last causal result
+  for (int c = 0; c < channels; ++c)
+    buf[last * channels + c] = buf[(last + 1) * channels + c] =
+      buf[(last + 2) * channels + c] = buf[(last - 1) * channels + c];
+  
+  // anti-causal, in-place
+  for (int i = last - 1; i >= first; --i) {
+    float* w = buf + i * channels;
+    for (int c = 0; c < channels; ++c)
+      w[c] = k.B * w[c] + k.b1 * w[c + channels] +
+	k.b2 * w[c + 2 * channels] + k.b3 * w[c + 3 * channels];
+  }
+  
+  // write back, rounded and saturated
+  for (int i = 0; i < n; ++i) {
+    uint8_t* dst = data + i * step;
+    const float* w = buf + (first + k.pad + i) * channels;
+    for (int c = 0; c < channels; ++c)
+      dst[c] = (uint8_t)std::min (std::max (w[c] + .5f, 0.f), 255.f);
+  }
+}
+
+void RecursiveGaussianBlur(Image& image, double standard_deviation)
+{
+  if (image.bps != 8) {
+    GaussianBlur(image, standard_deviation, 1 + (int)(3 * standard_deviation));
+    return;
+  }
+  
+  const recursive_coefficients k (standard_deviation);
+  uint8_t* data = image.getRawData();
+  const int stride = image.stride();
+  const int spp = image.spp;
+  const int w = image.w, h = image.h;
+  
+  // horizontal, the samples of one pixel are the channels
+#pragma omp parallel for schedule (dynamic, 16)
+  for (int y = 0; y < h; ++y) {
+    std::vector<float> buf ((w + 2 * k.pad + 6) * spp);
+    recursive_filter (k, data + y * stride, w, spp, spp, &buf[0]);
+  }
+  
+  // vertical, in cache friendly blocks of byte columns
+  const int block = 64;
+  const int bytes = image.stridefill();
+  const int blocks = (bytes + block - 1) / block;
+#pragma omp parallel for schedule (dynamic, 1)
+  for (int b = 0; b < blocks; ++b) {
+    const int x = b * block;
+    const int channels = std::min (block, bytes - x);
+    std::vector<float> buf ((h + 2 * k.pad + 6) * channels);
+    recursive_filter (k, data + x, h, stride, channels, &buf[0]);
+  }
+  
+  image.setRawData(); // invalidate as altered
 }
@@ -19,7 +19,17 @@
 
 #include "Image.hh"
 
-// when radius <= 0, then an optimal radius for sd is used
+// when radius <= 0, then an optimal radius for sd is used,
+// when radius <= 0 and the standard deviation is at least the
+// recursive_gaussian_threshold the recursive version is used
 void GaussianBlur(Image& image, double standard_deviation, int radius=0);
 
+// sd independent O(1) per pixel, 8 bit per sample, IIR approximation,
+// the maximal error against the exact kernel is 4 levels (of 255), the
+// mean below 0.5 (2D, sd 10 and 20, step edges plus impulses, 3 sd away
+// from the borders); in 1D about 3 levels for sd 4 to 6, 2 for sd 10,
+// 1.2 for sd 20 and 0.9 for sd 40
+const double recursive_gaussian_threshold = 10;
+void RecursiveGaussianBlur(Image& image, double standard_deviation);
+
 #endif
@@ -22,6 +22,7 @@
 #define DEPRECATED
 #include "Image.hh"
 #include "Codecs.hh"
+#include "profile.hh"
 
 Image::Image ()
   : modified(false), meta_modified(false), xres(0), yres(0), codec(0), data(0), w(0), h(0), bps(0), spp(0), rowstride(0)
@@ -82,6 +83,7 @@ uint8_t* Image::getRawData () const {
   if (!data && codec) {
     Image* image = const_cast<Image*>(this);
     codec->decodeNow (image);
+    profile_decode ();
     if (data) // if data was added
       image->modified = false;
   }
@@ -119,6 +121,7 @@ void Image::setRawDataWithoutDelete (uint8_t* _data) {
 }
 
 bool Image::resize (int _w, int _h, unsigned _stride) {
+  const uint64_t old_size = data ? (uint64_t)stride() * h : 0;
   std::swap(w, _w);
   std::swap(h, _h);
   if (_stride && _stride < stridefill()) { // sanity check new _stride
@@ -132,6 +135,7 @@ bool Image::resize (int _w, int _h, unsigned _stride) {
   
   uint8_t* ptr = (uint8_t*)::realloc(data, stride() * h);
   if (ptr) {
+    profile_allocation(old_size, (uint64_t)stride() * h);
     setRawDataWithoutDelete(ptr);
   } else {
     // if non-zero size
@@ -177,14 +181,32 @@ const std::string& Image::getDecoderID () {
   return decoderID;
 }
 
+void Image::setCompression (const std::string& c) {
+  compression = c;
+}
+
+const std::string& Image::getCompression () {
+  return compression;
+}
+
 ImageCodec* Image::getCodec() {
   return codec;
 }
 
+ImageCodec* Image::detachCodec () {
+  ImageCodec* c = codec;
+  codec = 0;
+  return c;
+}
+
 void Image::setCodec (ImageCodec* _codec) {
-  // do not reset, nor free when the same codec is re-set
-  if (codec == _codec)
+  // do not free when the same codec is re-set, e.g. after it rewrote
+  // its compressed data, but the data is recent again
+  if (codec == _codec) {
+    if (codec)
+      modified = false;
     return;
+  }
   
   // release attached codec
   if (codec) {
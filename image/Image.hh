@@ -105,7 +105,7 @@ protected:
   bool modified, meta_modified;
   int xres, yres;
   
-  std::string decoderID;
+  std::string decoderID, compression;
   ImageCodec* codec;
   
   uint8_t* data;
@@ -124,8 +124,11 @@ public:
   
   void setDecoderID (const std::string& id);
   const std::string& getDecoderID ();
+  void setCompression (const std::string& c);
+  const std::string& getCompression ();
   ImageCodec* getCodec();
   void setCodec (ImageCodec* _codec);
+  ImageCodec* detachCodec (); // without releasing it, e.g. to hand it over
   
   bool isModified () { return modified; }
   bool isMetaModified () { return meta_modified; }
@@ -20,23 +20,78 @@
 
 #include <string.h>
 
-void append (Image& image, Image& other)
+#include <algorithm>
+#include <iostream>
+
+// copy a row of bits, padding the rest of the destination row with white
+static inline void copy_row (uint8_t* dst, unsigned dst_bytes,
+			     const uint8_t* src, unsigned src_bits)
 {
-  // TODO: currently we support images with the same with
-  if (image.w != other.w) {
-    std::cerr << "image append: different image width unimplemented" << std::endl;
-    return;
+  unsigned i = src_bits / 8;
+  memcpy (dst, src, i);
+  if (src_bits % 8) {
+    dst[i] = src[i] | (0xff >> (src_bits % 8));
+    ++i;
   }
+  memset (dst + i, 0xff, dst_bytes - i);
+}
+
+void append (Image& image, const std::vector<Image*>& others)
+{
+  // must be in the same colorspace, each strip converted on its own
+  const std::string colorspace = colorspace_name(image);
+#pragma omp parallel for schedule (dynamic, 1)
+  for (int i = 0; i < (int)others.size(); ++i)
+    colorspace_by_name(*others[i], colorspace);
   
-  // must be in the same colorspace
-  colorspace_by_name(other, colorspace_name(image));
+  std::vector<Image*> strips;
+  int w = image.w, h = image.h;
+  for (unsigned i = 0; i < others.size(); ++i) {
+    Image& other = *others[i];
+    if (other.spp != image.spp || other.bps != image.bps) {
+      std::cerr << "image append: colorspace conversion failed" << std::endl;
+      continue;
+    }
+    strips.push_back(&other);
+    w = std::max(w, other.w);
+    h += other.h;
+  }
+  if (strips.empty())
+    return;
   
-  // resize height
-  const unsigned int old_height = image.h;
-  image.resize(image.w, image.h + other.h);
+  const int first = image.h;
+  if (w == image.w && image.stride() == image.stridefill()) {
+    // same width: grow in place, one realloc
+    image.resize(image.w, h);
+  }
+  else {
+    // wider, or custom stride: compose into a new image, the first padded
+    Image composed;
+    composed.copyMeta(image);
+    composed.resize(w, h, 0);
+    
+    const uint8_t* src = image.getRawData();
+    uint8_t* dst = composed.getRawData();
+    for (int y = 0; y < image.h; ++y, dst += composed.stride())
+      copy_row(dst, composed.stride(), src + y * image.stride(),
+	       image.w * image.spp * image.bps);
+    
+    image.copyTransferOwnership(composed);
+  }
   
-  // copy raw content
-  memcpy(image.getRawData() + image.stride() * old_height,
-	 other.getRawData(),
-	 other.stride() * other.h);
+  const unsigned stride = image.stride();
+  uint8_t* dst = image.getRawData() + stride * first;
+  for (unsigned i = 0; i < strips.size(); ++i) {
+    Image& other = *strips[i];
+    const uint8_t* src = other.getRawData();
+    for (int y = 0; y < other.h; ++y, dst += stride)
+      copy_row(dst, stride, src + y * other.stride(),
+	       other.w * other.spp * other.bps);
+  }
+}
+
+void append (Image& image, Image& other)
+{
+  std::vector<Image*> others(1, &other);
+  append(image, others);
 }
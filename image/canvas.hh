@@ -17,4 +17,11 @@
 
 #include "Image.hh"
 
+#include <vector>
+
 void append (Image& image, Image& other);
+
+// append all at once: the others are converted to the colorspace of the
+// image in parallel, and stacked with one allocation, narrower ones padded
+// with white on the right
+void append (Image& image, const std::vector<Image*>& others);
@@ -19,12 +19,13 @@
 #include <string.h> // memmove
 #include <iostream>
 #include <algorithm>
-#ifndef _MSC_VER
+#include <stdlib.h> // abs
 #include <vector>
-#endif
 
+#include "Bits.hh"
 #include "Image.hh"
 #include "Codecs.hh"
+#include "profile.hh"
 
 #include "Colorspace.hh"
 
@@ -45,8 +46,10 @@ void crop (Image& image, int x, int y, unsigned int w, unsigned int h)
     return;
   
   if (!image.isModified() && image.getCodec())
-    if (image.getCodec()->crop(image, x, y, w, h))
+    if (image.getCodec()->crop(image, x, y, w, h)) {
+      profile_codec_fast_path ();
       return;
+    }
   
   /*
     std::cerr << "after limiting: " << x << " " << y
@@ -61,6 +64,15 @@ void crop (Image& image, int x, int y, unsigned int w, unsigned int h)
     return;
   }
   
+  // full width, just move the rows up at once
+  if (x == 0 && w == (unsigned int)image.w) {
+    uint8_t* data = image.getRawData ();
+    memmove (data, data + image.stride() * y, image.stride() * h);
+    image.setRawData (); // invalidate
+    image.h = h;
+    return;
+  }
+  
   // bit shifting is too expensive, crop at least byte-wide
   int orig_bps = image.bps;
   if (orig_bps < 8)
@@ -97,36 +109,183 @@ void crop (Image& image, int x, int y, unsigned int w, unsigned int h)
   }
 }
 
-// auto crop just the bottom of an image filled in the same, solid color
-// optimization: for sub-byte depth we compare a 8bit pattern unit at-a-time
-void fastAutoCrop (Image& image)
+/* The border detection compares against the color of the outermost
+   pixel of each side. Rows are compared at once against a row of that
+   color, with memcmp, while exact, and bi-level rows by whole bytes,
+   before pixels are counted one by one. */
+
+class BorderScan
 {
-  if (!image.getRawData())
-    return;
+public:
+  BorderScan (Image& image, unsigned int _tolerance)
+    : data (image.getRawData()), stride (image.stride()),
+      w (image.w), h (image.h), spp (image.spp), bps (image.bps),
+      tolerance (bps == 1 ? 0 : _tolerance) // no levels to tolerate
+  {
+  }
   
-  const int stride = image.stride();
-  const int stridefill = image.stridefill();
- 
-  int h = image.h - 1;
-  uint8_t* data = image.getRawData() + stride * h;
-  uint8_t* ref = data; // ref value to compare against
-  
-  // decrement at begining, to compare one line earlier with reference
-  for (--h, data -= stride; h >= 0; --h, data -= stride) {
-    // data row
-    int i = 0;
-    for (; i < stridefill; ++i)
-      {
-	if (data[i] != ref[i]) {
-	  break; // pixel differs, break out
-	}
+  // the reference color, of the pixel at x, y
+  void reference (int x, int y)
+  {
+    ref.resize(spp);
+    for (int s = 0; s < spp; ++s)
+      ref[s] = sample (data + y * stride, x * spp + s);
+    
+    // and a whole row of it, to compare with
+    ref_row.assign(stride, 0);
+    if (bps < 8) {
+      uint8_t pattern = 0;
+      for (int i = 0; i < 8 / bps; ++i)
+	pattern = pattern << bps | ref[0];
+      memset (&ref_row[0], pattern, stride);
+    }
+    else {
+      const int bytes = spp * bps / 8;
+      for (int i = 0; i < w; ++i)
+	memcpy (&ref_row[i * bytes], data + y * stride + x * bytes, bytes);
+    }
+  }
+  
+  bool differs (const uint8_t* row, int x) const
+  {
+    for (int s = 0; s < spp; ++s) {
+      const int v = sample (row, x * spp + s);
+      if ((unsigned int)std::abs(v - ref[s]) > tolerance)
+	return true;
+    }
+    return false;
+  }
+  
+  // bi-level: a whole byte of the reference color, to be skipped at once
+  bool sameByte (const uint8_t* row, int x, int dx) const
+  {
+    if (bps != 1 || x % 8 != (dx > 0 ? 0 : 7) || x / 8 >= w / 8)
+      return false;
+    return row[x / 8] == ref_row[x / 8];
+  }
+  
+  // the pixels of the row differing from the reference, up to stop
+  unsigned int rowDiffs (int y, unsigned int stop) const
+  {
+    const uint8_t* row = data + y * stride;
+    const int fill = (w * spp * bps) / 8; // whole bytes
+    
+    if (tolerance == 0 || bps == 1) {
+      if (memcmp (row, &ref_row[0], fill) == 0) {
+	// the remaining bits
+	unsigned int diffs = 0;
+	for (int x = fill * 8 / (spp * bps); x < w && diffs <= stop; ++x)
+	  diffs += differs (row, x);
+	return diffs;
+      }
+      
+      if (bps == 1) {
+	unsigned int diffs = 0;
+	int i = 0;
+	for (; i < fill && diffs <= stop; ++i)
+	  diffs += Exact::popcount[row[i] ^ ref_row[i]];
+	for (int x = i * 8; x < w && diffs <= stop; ++x)
+	  diffs += differs (row, x);
+	return diffs;
       }
+    }
     
-    if (i != stridefill)
-      break; // non-solid line, break out
+    unsigned int diffs = 0;
+    for (int x = 0; x < w && diffs <= stop; ++x)
+      diffs += differs (row, x);
+    return diffs;
   }
-  ++h; // we are at the line that differs
-  if (h == 0) // do not crop if the image is totally empty
+  
+  const uint8_t* data;
+  const int stride, w, h, spp, bps;
+  
+protected:
+  int sample (const uint8_t* row, int i) const
+  {
+    switch (bps) {
+    case 8:
+      return row[i];
+    case 16:
+      return ((const uint16_t*)row)[i];
+    default:
+      {
+	const int bit = i * bps;
+	return row[bit / 8] >> (8 - bps - bit % 8) & ((1 << bps) - 1);
+      }
+    }
+  }
+  
+  const unsigned int tolerance;
+  std::vector<int> ref;
+  std::vector<uint8_t> ref_row;
+};
+
+// the border columns from one side, within the rows [y1, y2)
+static int border_columns (BorderScan& scan, int x, int dx, int n,
+			   int y1, int y2, unsigned int noise)
+{
+  // differing pixels of each column, only tracked up to the first one
+  // that is over the noise allowed
+  std::vector<unsigned int> diffs(n, 0);
+  int limit = n;
+  for (int y = y1; y < y2 && limit > 0; ++y) {
+    const uint8_t* row = scan.data + y * scan.stride;
+    for (int i = 0; i < limit; ++i) {
+      if (i + 8 <= limit && scan.sameByte (row, x + dx * i, dx)) {
+	i += 7;
+	continue;
+      }
+      if (scan.differs (row, x + dx * i) && ++diffs[i] > noise) {
+	limit = i;
+	break;
+      }
+    }
+  }
+  return limit;
+}
+
+void fastAutoCrop (Image& image, int sides, unsigned int tolerance,
+		   unsigned int noise)
+{
+  if (!image.getRawData())
+    return;
+  
+  if (image.bps != 1 && image.bps != 2 && image.bps != 4 &&
+      image.bps != 8 && image.bps != 16)
+    return;
+  
+  BorderScan scan (image, tolerance);
+  int top = 0, bottom = image.h;
+  
+  if (sides & AUTO_CROP_TOP) {
+    scan.reference (0, 0);
+    while (top < bottom && scan.rowDiffs (top, noise) <= noise)
+      ++top;
+  }
+  
+  if (sides & AUTO_CROP_BOTTOM) {
+    scan.reference (0, image.h - 1);
+    while (bottom > top && scan.rowDiffs (bottom - 1, noise) <= noise)
+      --bottom;
+  }
+  
+  if (top >= bottom) // do not crop if the image is totally empty
+    return;
+  
+  int left = 0, right = image.w;
+  
+  if (sides & AUTO_CROP_LEFT) {
+    scan.reference (0, top);
+    left = border_columns (scan, 0, 1, image.w, top, bottom, noise);
+  }
+  
+  if (sides & AUTO_CROP_RIGHT) {
+    scan.reference (image.w - 1, top);
+    right -= border_columns (scan, image.w - 1, -1, image.w - left,
+			     top, bottom, noise);
+  }
+  
+  if (left >= right)
     return;
   
   // We could just tweak the image height here, but using the generic
@@ -134,5 +293,5 @@ void fastAutoCrop (Image& image)
   // jpeg cropping.
   // We do not explicitly check if we crop, the crop function will optimize
   // a NOP crop away for all callers.
-  return crop (image, 0, 0, image.w, h);
+  return crop (image, left, top, right - left, bottom - top);
 }
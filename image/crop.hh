@@ -20,6 +20,20 @@
 #define __CROP_HH
 
 void crop (Image& image, int x, int y, unsigned int w, unsigned int h);
-void fastAutoCrop (Image& image);
+
+// the borders fastAutoCrop may trim
+enum {
+  AUTO_CROP_TOP = 1,
+  AUTO_CROP_BOTTOM = 2,
+  AUTO_CROP_LEFT = 4,
+  AUTO_CROP_RIGHT = 8,
+  AUTO_CROP_ALL = 15
+};
+
+// auto crop the borders filled in the same, solid color, by default just
+// the bottom; tolerance is the difference allowed per sample, noise the
+// number of differing pixels a line may have and still be border
+void fastAutoCrop (Image& image, int sides = AUTO_CROP_BOTTOM,
+		   unsigned int tolerance = 0, unsigned int noise = 0);
 
 #endif
@@ -16,6 +16,8 @@
  * copyright holder ExactCODE GmbH Germany.
  */
 
+#include <string.h>
+
 #include <iostream>
 
 #include "Bits.hh"
@@ -27,6 +29,44 @@
 #include "empty-page.hh"
 #include "optimize2bw.hh"
 
+/* Obviously full pages are decided before any copy or conversion, by
+   counting pixels darker than 64 on every 4th row of the source, until
+   twice the allowed amount is exceeded. This is a heuristic, not a
+   guarantee: the optimize2bw normalization spans at least 128 levels,
+   but its radius-1 unsharp pass (2*p - blur) can still lift a dark
+   pixel next to darker neighbours above the threshold; the 2x margin
+   is what bounds such misjudgements. */
+static bool clearly_not_empty (Image& image, double limit,
+			       int marginH, int marginV)
+{
+  if (image.bps != 8 || (image.spp != 1 && image.spp != 3))
+    return false;
+  
+  const int spp = image.spp;
+  const int stride = image.stride();
+  const uint8_t* data = image.getRawData();
+  const int x1 = marginH, x2 = image.w - marginH;
+  
+  const double sampled_limit = limit / 4 * 2;
+  int dark = 0;
+  for (int row = marginV; row < image.h - marginV; row += 4)
+  {
+    const uint8_t* rowptr = data + stride * row + x1 * spp;
+    if (spp == 1) {
+      for (int x = x1; x < x2; ++x)
+	dark += *rowptr++ < 64;
+    }
+    else {
+      for (int x = x1; x < x2; ++x, rowptr += 3)
+	dark += (rowptr[0] * 77 + rowptr[1] * 150 + rowptr[2] * 29) < 64 * 256;
+    }
+    
+    if (dark > sampled_limit)
+      return true;
+  }
+  return false;
+}
+
 /* TODO: for more accurance one could introduce a hot-spot area that
    has a higher weight than the other (outer) region to more reliably
    detect crossed but otherwise empty pages */
@@ -39,6 +79,13 @@ bool detect_empty_page (Image& im, double percent, int marginH, int marginV,
   
   Image* image, img;
   
+  // unless the exact amount is asked for, exit as soon as it is decided
+  const bool early_exit = !set_pixels;
+  const double limit = percent * im.w * im.h / 100;
+  
+  if (early_exit && clearly_not_empty (im, limit, marginH, marginV))
+    return false;
+  
   if (im.spp == 1 && im.bps == 1) {
     image = &im;
   }
@@ -62,17 +109,29 @@ bool detect_empty_page (Image& im, double percent, int marginH, int marginV,
   const int stride = image->stride();
   const int stridefill = image->stridefill();
   
-  // count pixels by table lookup
+  // count pixels, by words, the rest by table lookup
   int pixels = 0;
   uint8_t* data = image->getRawData();
+  const int x1 = marginH/8, x2 = stridefill - marginH/8;
   for (int row = marginV; row < image->h - marginV; ++row)
   {
     uint8_t* rowptr = data + stride * row;
-    for (int x = marginH/8; x < stridefill - marginH/8; ++x) {
+    int x = x1;
+    for (; x + 4 <= x2; x += 4) {
+      uint32_t bits;
+      memcpy (&bits, rowptr + x, sizeof(bits));
+      // it counts the bits set - and we want the zeros ...
+      pixels += 32 - Exact::popcountf(bits);
+    }
+    for (; x < x2; ++x) {
       int b = Exact::popcount[rowptr[x]];
       // it is a bitsset table - and we want the zeros ...
       pixels += 8-b;
     }
+    
+    if (early_exit && pixels >= limit &&
+	(float)(100.0 * pixels / (image->w * image->h)) >= percent)
+      return false;
   }
 
   float image_percent = 100.0 * pixels / (image->w * image->h);
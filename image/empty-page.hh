@@ -22,6 +22,9 @@
 
 // if the image is not 1 bit per pixel it will be optimized to b/w
 // (if you want more control over that call it yourself before)
+// unless set_pixels is asked for, obviously full pages return early,
+// before any conversion, and bi-level ones once the threshold is exceeded
+
 // the margin are the border pixels skipped, it must be a multiple
 // of 8 for speed reasons and will be rounded down to the next
 // multiple of 8 if necessary.
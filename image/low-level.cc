@@ -21,21 +21,57 @@
 
 #include "low-level.hh"
 
-void deinterlace (Image& image)
+void permute_rows (Image& image, const std::vector<unsigned>& dst)
 {
-  const int stride = image.stride();
+  const unsigned stride = image.stride();
   const int height = image.height();
-  uint8_t* deinterlaced = (uint8_t*) malloc(image.stride() * height);
+  uint8_t* data = image.getRawData();
   
-  for (int i = 0; i < height; ++i)
-    {
-      const int dst_i = i / 2 + (i % 2) * (height / 2);
-      std::cerr << i << " - " << dst_i << std::endl;
-      uint8_t* dst = deinterlaced + stride * dst_i;
-      uint8_t* src = image.getRawData() + stride * i;
+  // the source of each row, and the first row of each cycle
+  std::vector<unsigned> src(height);
+  for (int y = 0; y < height; ++y)
+    src[dst[y]] = y;
+  
+  std::vector<unsigned> cycles;
+  std::vector<bool> visited(height, false);
+  for (int y = 0; y < height; ++y) {
+    if (visited[y])
+      continue;
+    for (unsigned i = y; !visited[i]; i = src[i])
+      visited[i] = true;
+    if (src[y] != (unsigned)y)
+      cycles.push_back(y);
+  }
+  
+  // the cycles are independent of each other
+#pragma omp parallel
+  {
+    uint8_t* scratch = (uint8_t*) malloc(stride);
+    
+#pragma omp for schedule (dynamic, 16)
+    for (int c = 0; c < (int)cycles.size(); ++c) {
+      const unsigned first = cycles[c];
+      memcpy(scratch, data + stride * first, stride);
       
-      memcpy(dst, src, stride);
+      unsigned i = first;
+      for (; src[i] != first; i = src[i])
+	memcpy(data + stride * i, data + stride * src[i], stride);
+      memcpy(data + stride * i, scratch, stride);
     }
+    
+    free(scratch);
+  }
+  
+  image.setRawData();
+}
+
+void deinterlace (Image& image)
+{
+  // the even rows to the first half, the odd ones to the second
+  const int height = image.height();
+  std::vector<unsigned> dst(height);
+  for (int i = 0; i < height; ++i)
+    dst[i] = i / 2 + (i % 2) * ((height + 1) / 2);
   
-  image.setRawData(deinterlaced);
+  permute_rows(image, dst);
 }
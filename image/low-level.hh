@@ -18,4 +18,9 @@
 
 #include "Image.hh"
 
+#include <vector>
+
+// moves each row y to row dst[y], in place with one row of scratch
+void permute_rows (Image& image, const std::vector<unsigned>& dst);
+
 void deinterlace (Image& image);
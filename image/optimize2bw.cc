@@ -38,9 +38,8 @@
 #include <cmath>
 #include <iostream>
 #include <iomanip>
-#ifdef _MSC_VER
 #include <vector>
-#endif
+#include <algorithm>
 
 #include "Image.hh"
 
@@ -195,3 +194,125 @@ void optimize2bw (Image& image, int low, int high, int threshold,
     decomposable_sym_convolution_matrix(image, &matrix[0], &matrix_2[0], radius, radius, 2.0);
   }
 }
+
+/* Sauvola / Niblack local thresholding.
+
+   The image is processed in horizontal bands, each band keeping the
+   vertical window sum and sum of squares per column, sliding it down
+   one row at a time. A prefix sum over those column sums then yields
+   the window statistics of each pixel in O(1) - an integral image
+   that never needs more than one row of memory per band. Bands are
+   independent and thus processed in parallel, each writing its 1-bit
+   rows directly into the output buffer. */
+
+void adaptive_threshold (Image& image, adaptive_method_t method,
+			 int window, double k)
+{
+  // do nothing if already at b/w, ...
+  if (image.spp == 1 && image.bps == 1)
+    return;
+  
+  if (image.spp != 1 || image.bps != 8)
+    colorspace_by_name(image, "gray8");
+  
+  if (window <= 0) {
+    const int res = image.resolutionX() ? image.resolutionX() : 300;
+    window = std::max(res / 10, 15);
+  }
+  const int r = window / 2;
+  
+  if (k == 0)
+    k = (method == ADAPTIVE_NIBLACK) ? -0.2 : 0.34;
+  const double R = 128; // dynamic range of the standard deviation
+  
+  const int w = image.w, h = image.h;
+  const unsigned stride = image.stride();
+  const unsigned ostride = (w + 7) / 8;
+  const uint8_t* data = image.getRawData();
+  uint8_t* output = (uint8_t*) malloc(ostride * h);
+  
+  // a band should be well larger than the window, to amortize its setup
+  const int band = std::max(64, 4 * r);
+  
+#pragma omp parallel for schedule (dynamic, 1)
+  for (int y0 = 0; y0 < h; y0 += band)
+    {
+      const int y1 = std::min(y0 + band, h);
+      std::vector<uint32_t> colsum(w, 0);
+      std::vector<uint64_t> colsq(w, 0);
+      std::vector<uint64_t> sum(w + 1, 0), sq(w + 1, 0);
+      
+      // prime the column sums with the window above the first row,
+      // including row y0 - r - 1 that the first slide removes again
+      for (int y = std::max(y0 - r - 1, 0); y < std::min(y0 + r, h); ++y) {
+	const uint8_t* it = data + y * stride;
+	for (int x = 0; x < w; ++x) {
+	  const uint32_t v = it[x];
+	  colsum[x] += v;
+	  colsq[x] += v * v;
+	}
+      }
+      
+      for (int y = y0; y < y1; ++y)
+	{
+	  // slide the vertical window: add row y + r, remove row y - r - 1
+	  if (y + r < h) {
+	    const uint8_t* it = data + (y + r) * stride;
+	    for (int x = 0; x < w; ++x) {
+	      const uint32_t v = it[x];
+	      colsum[x] += v;
+	      colsq[x] += v * v;
+	    }
+	  }
+	  if (y - r - 1 >= 0) {
+	    const uint8_t* it = data + (y - r - 1) * stride;
+	    for (int x = 0; x < w; ++x) {
+	      const uint32_t v = it[x];
+	      colsum[x] -= v;
+	      colsq[x] -= v * v;
+	    }
+	  }
+	  const int rows = std::min(y + r, h - 1) - std::max(y - r, 0) + 1;
+	  
+	  for (int x = 0; x < w; ++x) {
+	    sum[x + 1] = sum[x] + colsum[x];
+	    sq[x + 1] = sq[x] + colsq[x];
+	  }
+	  
+	  const uint8_t* it = data + y * stride;
+	  uint8_t* out = output + y * ostride;
+	  uint8_t z = 0;
+	  int x = 0;
+	  for (; x < w; ++x)
+	    {
+	      const int x0 = std::max(x - r, 0);
+	      const int x1 = std::min(x + r + 1, w);
+	      const double n = (double)(x1 - x0) * rows;
+	      const double mean = (sum[x1] - sum[x0]) / n;
+	      const double var = std::max((sq[x1] - sq[x0]) / n - mean * mean, 0.);
+	      const double sd = sqrt(var);
+	      
+	      double t;
+	      if (method == ADAPTIVE_NIBLACK)
+		t = mean + k * sd;
+	      else
+		t = mean * (1 + k * (sd / R - 1));
+	      
+	      z <<= 1;
+	      if (it[x] > t)
+		z |= 0x01;
+	      
+	      if (x % 8 == 7) {
+		*out++ = z;
+		z = 0;
+	      }
+	    }
+	  int remainder = 8 - x % 8;
+	  if (remainder != 8)
+	    *out++ = z << remainder;
+	}
+    }
+  
+  image.bps = 1; image.rowstride = 0;
+  image.setRawData(output);
+}
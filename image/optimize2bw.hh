@@ -32,4 +32,19 @@ void optimize2bw (Image& image, int low = 0, int high = 0, int threshold = 0,
 		  int radius = 3,
 		  double standard_deviation = 2.1);
 
+// Local adaptive thresholding of 8-bit gray data to b/w (1-bit), as an
+// alternative to a global threshold for unevenly lit or stained pages.
+// Uses running window sums (integral images) so the cost per pixel is
+// independent of the window size. A window of 0 derives the size from the
+// resolution, a k of 0 selects the method's customary default.
+
+typedef enum {
+  ADAPTIVE_SAUVOLA,
+  ADAPTIVE_NIBLACK
+} adaptive_method_t;
+
+void adaptive_threshold (Image& image,
+			 adaptive_method_t method = ADAPTIVE_SAUVOLA,
+			 int window = 0, double k = 0);
+
 #endif // OPTIMIZE2BW_HH
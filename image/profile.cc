@@ -0,0 +1,197 @@
+/*
+ * Lightweight, per operation profiling and memory instrumentation.
+ * Copyright (C) 2016 René Rebe, ExactCODE GmbH Germany.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2. A copy of the GNU General
+ * Public License can be found in the file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANT-
+ * ABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * Alternatively, commercial licensing options are available from the
+ * copyright holder ExactCODE GmbH Germany.
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+
+#ifndef _MSC_VER
+#include <pthread.h>
+#endif
+
+#include "profile.hh"
+
+image_stats_t image_stats = { 0, 0, 0, 0 };
+
+// set before the operations start, only read while they run
+static bool enabled = false;
+
+#ifndef _MSC_VER
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static inline void stats_lock () { pthread_mutex_lock (&stats_mutex); }
+static inline void stats_unlock () { pthread_mutex_unlock (&stats_mutex); }
+#else
+static inline void stats_lock () {}
+static inline void stats_unlock () {}
+#endif
+
+struct record {
+  std::string operation;
+  double wall, cpu;
+  image_stats_t stats;
+};
+
+static std::vector<record> records;
+static record current;
+
+static double wall_time ()
+{
+#ifndef _WIN32
+  struct timeval tv;
+  gettimeofday (&tv, 0);
+  return tv.tv_sec + tv.tv_usec / 1000000.;
+#else
+  return (double)time (0);
+#endif
+}
+
+static double cpu_time ()
+{
+  return (double)clock () / CLOCKS_PER_SEC;
+}
+
+void profile_allocation (uint64_t old_size, uint64_t new_size)
+{
+  if (!enabled)
+    return;
+  
+  stats_lock ();
+  if (new_size > old_size)
+    image_stats.allocated += new_size - old_size;
+  if (new_size > image_stats.peak_buffer)
+    image_stats.peak_buffer = new_size;
+  stats_unlock ();
+}
+
+void profile_decode ()
+{
+  if (!enabled)
+    return;
+  
+  stats_lock ();
+  ++image_stats.decodes;
+  stats_unlock ();
+}
+
+void profile_codec_fast_path ()
+{
+  if (!enabled)
+    return;
+  
+  stats_lock ();
+  ++image_stats.fast_paths;
+  stats_unlock ();
+}
+
+void profile_enable (bool enable)
+{
+  enabled = enable;
+}
+
+bool profile_enabled ()
+{
+  return enabled;
+}
+
+void profile_begin (const std::string& operation)
+{
+  if (!enabled)
+    return;
+  
+  current.operation = operation;
+  current.wall = wall_time ();
+  current.cpu = cpu_time ();
+  stats_lock ();
+  current.stats = image_stats;
+  image_stats.peak_buffer = 0; // per operation
+  stats_unlock ();
+}
+
+void profile_end ()
+{
+  if (!enabled || current.operation.empty())
+    return;
+  
+  record r = current;
+  r.wall = wall_time () - current.wall;
+  r.cpu = cpu_time () - current.cpu;
+  stats_lock ();
+  r.stats.allocated = image_stats.allocated - current.stats.allocated;
+  r.stats.peak_buffer = image_stats.peak_buffer;
+  r.stats.decodes = image_stats.decodes - current.stats.decodes;
+  r.stats.fast_paths = image_stats.fast_paths - current.stats.fast_paths;
+  records.push_back (r);
+  
+  // restore the overall peak
+  if (current.stats.peak_buffer > image_stats.peak_buffer)
+    image_stats.peak_buffer = current.stats.peak_buffer;
+  stats_unlock ();
+  current.operation.clear();
+}
+
+void profile_report (std::ostream& s, bool json)
+{
+  std::ios::fmtflags flags = s.flags();
+  s.setf (std::ios::fixed, std::ios::floatfield);
+  s.precision (3);
+  
+  if (json) {
+    s << "[";
+    for (unsigned i = 0; i < records.size(); ++i) {
+      const record& r = records[i];
+      s << (i ? ",\n " : "\n ")
+	<< "{\"operation\": \"" << r.operation << "\", "
+	<< "\"wall_ms\": " << r.wall * 1000 << ", "
+	<< "\"cpu_ms\": " << r.cpu * 1000 << ", "
+	<< "\"allocated\": " << r.stats.allocated << ", "
+	<< "\"peak_buffer\": " << r.stats.peak_buffer << ", "
+	<< "\"deferred_decodes\": " << r.stats.decodes << ", "
+	<< "\"codec_fast_paths\": " << r.stats.fast_paths << "}";
+    }
+    s << "\n]" << std::endl;
+  }
+  else {
+    s << std::left << std::setw(20) << "operation" << std::right
+      << std::setw(12) << "wall ms" << std::setw(12) << "cpu ms"
+      << std::setw(14) << "allocated" << std::setw(14) << "peak buffer"
+      << std::setw(8) << "decode" << std::setw(8) << "codec" << std::endl;
+    
+    for (unsigned i = 0; i < records.size(); ++i) {
+      const record& r = records[i];
+      s << std::left << std::setw(20) << r.operation << std::right
+	<< std::setw(12) << r.wall * 1000 << std::setw(12) << r.cpu * 1000
+	<< std::setw(14) << r.stats.allocated << std::setw(14) << r.stats.peak_buffer
+	<< std::setw(8) << r.stats.decodes << std::setw(8) << r.stats.fast_paths
+	<< std::endl;
+    }
+  }
+  
+  s.flags (flags);
+}
+
+void profile_clear ()
+{
+  records.clear ();
+}
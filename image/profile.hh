@@ -0,0 +1,59 @@
+/*
+ * Lightweight, per operation profiling and memory instrumentation.
+ * Copyright (C) 2016 René Rebe, ExactCODE GmbH Germany.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2. A copy of the GNU General
+ * Public License can be found in the file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANT-
+ * ABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+ * Public License for more details.
+ *
+ * Alternatively, commercial licensing options are available from the
+ * copyright holder ExactCODE GmbH Germany.
+ */
+
+/* The counters are only updated while profiling is enabled, under a
+ * lock, as images are allocated and decoded from several threads (e.g.
+ * the read-ahead decoder or parallel loops); the per operation records
+ * are collected between profile_begin() and profile_end(), e.g. by
+ * econvert --profile or the API's profile* functions.
+ */
+
+#ifndef PROFILE_HH
+#define PROFILE_HH
+
+#include <stdint.h>
+
+#include <string>
+#include <iosfwd>
+
+struct image_stats_t
+{
+  uint64_t allocated;   // bytes (re-)allocated for image buffers
+  uint64_t peak_buffer; // largest single image buffer
+  unsigned decodes;     // deferred, on-demand codec decodes
+  unsigned fast_paths;  // operations performed by the codec (e.g. JPEG DCT)
+};
+
+extern image_stats_t image_stats;
+
+// hooks for the Image and the operations
+void profile_allocation (uint64_t old_size, uint64_t new_size);
+void profile_decode ();
+void profile_codec_fast_path ();
+
+// per operation recording
+void profile_enable (bool enable = true);
+bool profile_enabled ();
+
+void profile_begin (const std::string& operation);
+void profile_end ();
+
+void profile_report (std::ostream& s, bool json = false);
+void profile_clear ();
+
+#endif // PROFILE_HH
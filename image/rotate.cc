@@ -24,15 +24,30 @@
 #include "Image.hh"
 #include "ImageIterator2.hh"
 #include "Codecs.hh"
+#include "profile.hh"
+#include "low-level.hh"
 
 #include "rotate.hh"
 
+// mirror a row of whole pixels of B bytes
+template <unsigned B>
+static inline void flip_pixels (uint8_t* row, int w)
+{
+  uint8_t* ptr1 = row;
+  uint8_t* ptr2 = row + (w - 1) * B;
+  for (; ptr1 < ptr2; ptr1 += B, ptr2 -= B)
+    for (unsigned b = 0; b < B; ++b)
+      std::swap(ptr1[b], ptr2[b]);
+}
+
 void flipX (Image& image)
 {
   // thru the codec?
   if (!image.isModified() && image.getCodec())
-    if (image.getCodec()->flipX(image))
+    if (image.getCodec()->flipX(image)) {
+      profile_codec_fast_path ();
       return;
+    }
 
   uint8_t* data = image.getRawData();
   const int stride = image.stride();
@@ -58,17 +73,27 @@ void flipX (Image& image)
 	  reversed_bits[i] = rev;
 	}
 	
+	// the padding bits of the last byte are reversed to the front
+	const int pad = stridefill * 8 - image.w * image.spp * bps;
+	
+#pragma omp parallel for schedule (dynamic, 16)
 	for (int y = 0; y < image.h; ++y)
 	  {
 	    uint8_t* row = data + y * stride;
 	    for (int x = 0; x < stridefill / 2; ++x) {
 	      uint8_t v = row [x];
 	      row[x] = reversed_bits[row[stridefill - 1 - x]];
-	      row[stride - 1 - x] = reversed_bits[v];
+	      row[stridefill - 1 - x] = reversed_bits[v];
 	    }
-	    // TODO: this still needs to be fixed for stride < 1 byte!
             if (stridefill & 1) // uneven? center-byte:
 	      row[stridefill / 2] = reversed_bits[row[stridefill / 2]];
+	    
+	    // and shifted back out
+	    if (pad) {
+	      for (int x = 0; x < stridefill - 1; ++x)
+		row[x] = row[x] << pad | row[x + 1] >> (8 - pad);
+	      row[stridefill - 1] <<= pad;
+	    }
 	  }
       }
       break;
@@ -78,16 +103,17 @@ void flipX (Image& image)
     case 32:
     case 48:
       {
-	const unsigned int bytes = image.spp * image.bps / 8;
+	const int bytes = image.spp * image.bps / 8;
+#pragma omp parallel for schedule (dynamic, 16)
 	for (int y = 0; y < image.h; ++y)
 	  {
-	    uint8_t* ptr1 = data + y * stride;
-	    uint8_t* ptr2 = ptr1 + stridefill - bytes;
-	    
-	    for (; ptr1 < ptr2; ptr2 -= 2 * bytes) {
-	      for (unsigned b = 0; b < bytes; b++) {
-		std::swap(*ptr1++, *ptr2++);
-	      }
+	    uint8_t* row = data + y * stride;
+	    switch (bytes) {
+	    case 1: flip_pixels<1>(row, image.w); break;
+	    case 2: flip_pixels<2>(row, image.w); break;
+	    case 3: flip_pixels<3>(row, image.w); break;
+	    case 4: flip_pixels<4>(row, image.w); break;
+	    case 6: flip_pixels<6>(row, image.w); break;
 	    }
 	  }
       }
@@ -103,113 +129,146 @@ void flipY (Image& image)
 {
   // thru the codec?
   if (!image.isModified() && image.getCodec())
-    if (image.getCodec()->flipY(image))
+    if (image.getCodec()->flipY(image)) {
+      profile_codec_fast_path ();
       return;
+    }
 
-  uint8_t* data = image.getRawData();
-  const unsigned int bytes = image.stride();
-  for (int y = 0; y < image.h / 2; ++y)
-    {
-      int y2 = image.h - y - 1;
+  std::vector<unsigned> dst(image.h);
+  for (int y = 0; y < image.h; ++y)
+    dst[y] = image.h - y - 1;
+  permute_rows(image, dst);
+}
 
-      uint8_t* row1 = &data[y * bytes];
-      uint8_t* row2 = &data[y2 * bytes];
+/*
+ The transposed image, optionally flipped in the same pass:
+ the pixel (x, y) is moved to (fx ? h - 1 - y : y, fy ? w - 1 - x : x).
+ Thus 90 degrees clock-wise is fx, counter clock-wise fy, and the EXIF
+ transverse orientation both.
 
-      for (unsigned x = 0; x < bytes; ++x)
-	{
-	  uint8_t v = *row1;
-	  *row1++ = *row2;
-	  *row2++ = v;
+ The source is walked in square tiles, so the column-wise reads stay in
+ the cache, and parallel over the tile columns, each one writing its own
+ destination rows.
+*/
+
+static const int transpose_tile = 64;
+
+template <unsigned B>
+static void transpose_bytes (const uint8_t* src, unsigned src_stride,
+			     uint8_t* dst, unsigned dst_stride,
+			     int w, int h, bool fx, bool fy)
+{
+#pragma omp parallel for schedule (dynamic, 1)
+  for (int bx = 0; bx < w; bx += transpose_tile)
+    for (int by = 0; by < h; by += transpose_tile) {
+      const int x2 = std::min(bx + transpose_tile, w);
+      const int y2 = std::min(by + transpose_tile, h);
+      for (int x = bx; x < x2; ++x) {
+	uint8_t* drow = dst + (fy ? w - 1 - x : x) * dst_stride;
+	const uint8_t* s = src + by * src_stride + x * B;
+	if (fx) {
+	  uint8_t* d = drow + (h - 1 - by) * B;
+	  for (int y = by; y < y2; ++y, s += src_stride, d -= B)
+	    for (unsigned b = 0; b < B; ++b)
+	      d[b] = s[b];
 	}
+	else {
+	  uint8_t* d = drow + by * B;
+	  for (int y = by; y < y2; ++y, s += src_stride, d += B)
+	    for (unsigned b = 0; b < B; ++b)
+	      d[b] = s[b];
+	}
+      }
     }
-  image.setRawData();
 }
 
-void rot90 (Image& image, int angle)
+// 8x8 bit matrix transpose, rows MSB first, Hacker's Delight style
+static inline uint64_t transpose8x8 (uint64_t x)
 {
-  bool cw = false; // clock-wise
-  if (angle == 90)
-    cw = true; // else 270 or -90 or whatever and thus counter cw
-   
-  uint8_t* _data = image.getRawData();
-  int data_stride = image.stride();
-  int rot_stride = (image.h * image.spp * image.bps + 7) / 8;
-  uint8_t* rot_data = (uint8_t*) malloc(rot_stride * image.w);
+  uint64_t t;
+  t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL; x = x ^ t ^ (t << 7);
+  t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL; x = x ^ t ^ (t << 14);
+  t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL; x = x ^ t ^ (t << 28);
+  return x;
+}
+
+// bi-level, in 8x8 blocks; without fx, which is left to flipX
+static void transpose_bits (const uint8_t* src, unsigned src_stride,
+			    uint8_t* dst, unsigned dst_stride,
+			    int w, int h, bool fy)
+{
+  const int bytes = (w + 7) / 8;
+#pragma omp parallel for schedule (dynamic, 16)
+  for (int bx = 0; bx < bytes; ++bx)
+    for (int y = 0; y < h; y += 8) {
+      uint64_t m = 0;
+      for (int i = 0; i < 8; ++i)
+	m = m << 8 | (y + i < h ? src[(y + i) * src_stride + bx] : 0);
+      m = transpose8x8(m);
+      for (int i = 0; i < 8; ++i) {
+	const int x = bx * 8 + i;
+	if (x >= w)
+	  break;
+	dst[(fy ? w - 1 - x : x) * dst_stride + y / 8] = m >> (56 - 8 * i);
+      }
+    }
+}
+
+// 2 and 4 bit gray, sample by sample
+static void transpose_samples (const uint8_t* src, unsigned src_stride,
+			       uint8_t* dst, unsigned dst_stride,
+			       int w, int h, int bps, bool fx, bool fy)
+{
+  const int mask = (1 << bps) - 1;
+#pragma omp parallel for schedule (dynamic, 1)
+  for (int bx = 0; bx < w; bx += transpose_tile)
+    for (int by = 0; by < h; by += transpose_tile) {
+      const int x2 = std::min(bx + transpose_tile, w);
+      const int y2 = std::min(by + transpose_tile, h);
+      for (int x = bx; x < x2; ++x) {
+	uint8_t* drow = dst + (fy ? w - 1 - x : x) * dst_stride;
+	const int sbit = x * bps;
+	for (int y = by; y < y2; ++y) {
+	  const int v = src[y * src_stride + sbit / 8] >> (8 - bps - sbit % 8) & mask;
+	  const int dbit = (fx ? h - 1 - y : y) * bps;
+	  drow[dbit / 8] |= v << (8 - bps - dbit % 8);
+	}
+      }
+    }
+}
+
+static void transpose (Image& image, bool fx, bool fy)
+{
+  const uint8_t* data = image.getRawData();
+  const unsigned data_stride = image.stride();
+  const unsigned rot_stride = (image.h * image.spp * image.bps + 7) / 8;
+  uint8_t* rot_data = (uint8_t*) calloc(rot_stride, image.w);
   
+  const int w = image.w, h = image.h;
   switch (image.spp * image.bps)
     {
     case 1:
+      transpose_bits(data, data_stride, rot_data, rot_stride, w, h, fy);
+      break;
     case 2:
-    case 4: {
-      const int bps = image.bps;
-      const int spb = 8 / bps; // Samples Per Byte
-      const uint8_t mask =  0xF00 >> bps;
-      // std::cerr << "mask: " << (int)mask << std::endl;
-      
-      for (int y = 0; y < image.h; ++y) {
-	uint8_t* data = _data + y * data_stride;
-	uint8_t* new_row = 
-	  cw ?
-	  &rot_data [ (image.h - 1 - y) / spb ] :
-	  &rot_data [ (image.w - 1) * rot_stride + y / spb ];
-	
-	for (int x = 0; x < image.w;) {
-	  // spread the bits thru the various row slots
-	  uint8_t bits = *data++;
-	  int i = 0;
-	  for (; i < spb && x < image.w; ++i) {
-	    if (cw) {
-	      *new_row = *new_row >> bps | (bits & mask);
-	      new_row += rot_stride;
-	    }
-	    else {
-	      *new_row = *new_row << bps | (bits & mask) >> (8-bps);
-	      new_row -= rot_stride;
-	    }
-	    bits <<= bps;
-	    ++x;
-	  }
-	  // finally shift the last line if necessary
-	  // TODO: recheck this residual bit for correctness
-	  if (i < spb) {
-	    if (cw) {
-	      new_row -= rot_stride;
-	      *new_row = *new_row >> (8 - (bps*i));
-	    }
-	    else {
-	      new_row += rot_stride;
-	      *new_row = *new_row << (8 - (bps*i));
-	    }
-	    bits <<= 1;
-	    ++x;
-	  }
-	}
-      }
-    }
+    case 4:
+      transpose_samples(data, data_stride, rot_data, rot_stride, w, h,
+			image.bps, fx, fy);
       break;
-      
     case 8:
+      transpose_bytes<1>(data, data_stride, rot_data, rot_stride, w, h, fx, fy);
+      break;
     case 16:
+      transpose_bytes<2>(data, data_stride, rot_data, rot_stride, w, h, fx, fy);
+      break;
     case 24:
+      transpose_bytes<3>(data, data_stride, rot_data, rot_stride, w, h, fx, fy);
+      break;
     case 32:
+      transpose_bytes<4>(data, data_stride, rot_data, rot_stride, w, h, fx, fy);
+      break;
     case 48:
-      {
-	const int bps = (image.bps + 7) / 8 * image.spp; // bytes...
-	
-	for (int y = 0; y < image.h; ++y) {
-	  uint8_t* data = _data + y * data_stride;
-	  uint8_t* new_row =
-	    cw ?
-	    &rot_data[(image.h - 1 - y) * bps] :
-	    &rot_data[(image.w - 1) * rot_stride + (y * bps)];
-	  
-	  for (int x = 0; x < image.w; ++x) {
-	    for (int i = 0; i < bps; ++i)
-	      *new_row++ = *data++;
-	    new_row += cw ? rot_stride - bps : -rot_stride - bps;
-	  }
-	}
-      }
+      transpose_bytes<6>(data, data_stride, rot_data, rot_stride, w, h, fx, fy);
       break;
       
     default:
@@ -228,6 +287,18 @@ void rot90 (Image& image, int angle)
   // set the new data
   image.rowstride = 0;
   image.setRawData(rot_data);
+  
+  if (image.spp * image.bps == 1 && fx)
+    flipX(image);
+}
+
+void rot90 (Image& image, int angle)
+{
+  bool cw = false; // clock-wise
+  if (angle == 90)
+    cw = true; // else 270 or -90 or whatever and thus counter cw
+  
+  transpose(image, cw, !cw);
 }
 
 template <typename T>
@@ -301,8 +372,10 @@ void rotate (Image& image, double angle, const Image::iterator& background)
 
   // thru the codec?
   if (!image.isModified() && image.getCodec())
-    if (image.getCodec()->rotate(image, angle))
-       return;
+    if (image.getCodec()->rotate(image, angle)) {
+      profile_codec_fast_path ();
+      return;
+    }
    
   if (angle == 180.0) {
     flipX (image);
@@ -339,11 +412,20 @@ void exif_rotate(Image& image, unsigned exif_orientation)
   case 4: // bottom, left side
     flipY(image); break;
   case 5: // left side, top
-    rotate(image, -90, bgrd); break; // tested
+    // keep the lossless codec path for untouched images
+    if (!image.isModified() && image.getCodec()) {
+      rotate(image, 90, bgrd); flipX(image);
+    } else
+      transpose(image, false, false);
+    break;
   case 6: // right side, top
     rotate(image, 90, bgrd); break; // tested
   case 7: // right side, bottom
-    rotate(image, 90, bgrd); flipX(image); break;
+    if (!image.isModified() && image.getCodec()) {
+      rotate(image, -90, bgrd); flipX(image);
+    } else
+      transpose(image, true, true);
+    break;
   case 8: // left side, bottom
     rotate(image, -90, bgrd); break; // tested
   default:
@@ -22,17 +22,17 @@
 #include <iostream>
 #include <algorithm>
 
+#include "Bits.hh"
 #include "Image.hh"
 #include "ImageIterator2.hh"
 #include "Codecs.hh"
+#include "profile.hh"
 
 #include "Colorspace.hh"
 
 #include "scale.hh"
 
-#ifdef _MSC_VER
 #include <vector>
-#endif
 
 void scale (Image& image, double scalex, double scaley, bool fixed)
 {
@@ -41,8 +41,10 @@ void scale (Image& image, double scalex, double scaley, bool fixed)
   
   // thru the codec?
   if (!image.isModified() && image.getCodec())
-    if (image.getCodec()->scale(image, scalex, scaley, fixed))
+    if (image.getCodec()->scale(image, scalex, scaley, fixed)) {
+      profile_codec_fast_path ();
       return;
+    }
   
   if (scalex <= 0.5 && !fixed)
     box_scale (image, scalex, scaley, fixed);
@@ -50,6 +52,32 @@ void scale (Image& image, double scalex, double scaley, bool fixed)
     bilinear_scale (image, scalex, scaley, fixed);
 }
 
+bool scale_by_name (Image& image, const std::string& method,
+		    double scalex, double scaley, bool fixed)
+{
+  std::string name = method;
+  std::transform (name.begin(), name.end(), name.begin(), tolower);
+  
+  if (name.empty() || name == "auto")
+    scale (image, scalex, scaley, fixed);
+  else if (name == "nearest")
+    nearest_scale (image, scalex, scaley, fixed);
+  else if (name == "box")
+    box_scale (image, scalex, scaley, fixed);
+  else if (name == "bilinear")
+    bilinear_scale (image, scalex, scaley, fixed);
+  else if (name == "bicubic")
+    bicubic_scale (image, scalex, scaley, fixed);
+  else if (name == "lanczos" || name == "lanczos3")
+    resample_scale (image, scalex, scaley, RESAMPLE_LANCZOS3, fixed);
+  else if (name == "mitchell")
+    resample_scale (image, scalex, scaley, RESAMPLE_MITCHELL, fixed);
+  else
+    return false;
+  
+  return true;
+}
+
 template <typename T>
 struct nearest_scale_template
 {
@@ -182,6 +210,53 @@ void bilinear_scale (Image& image, double scalex, double scaley, bool fixed)
   codegen<bilinear_scale_template> (image, scalex, scaley, fixed);
 }
 
+// Box boundaries shared by the box reducers: destination box d covers the
+// source range start[d] .. start[d+1]-1, i.e. all s with s * nn / n == d.
+static void box_starts (int n, int nn, std::vector<int>& start)
+{
+  start.resize (nn + 1);
+  int s = 0;
+  for (int d = 0; d <= nn; ++d) {
+    while (s < n && (int64_t)s * nn / n < d)
+      ++s;
+    start[d] = s;
+  }
+}
+
+// reduce one row of column sums into the destination boxes, for the
+// integer ratios the box width FX is known at compile time, as is SPP
+template <int FX, int SPP>
+static inline void box_reduce_row (uint8_t* d, const uint32_t* c, int nw,
+				   int spp, const int* xstart, uint32_t ry)
+{
+  if (SPP)
+    spp = SPP;
+  for (int dx = 0; dx < nw; ++dx) {
+    const int x0 = FX ? dx * FX : xstart[dx];
+    const int n = FX ? FX : xstart[dx + 1] - x0;
+    const uint32_t count = n * ry;
+    const uint32_t* cc = c + x0 * spp;
+    for (int ch = 0; ch < spp; ++ch) {
+      uint32_t sum = 0;
+      for (int i = 0; i < n; ++i)
+	sum += cc[i * spp + ch];
+      *d++ = count ? sum / count : 0;
+    }
+  }
+}
+
+template <int SPP>
+static void box_reduce (uint8_t* d, const uint32_t* c, int nw, int spp,
+			int fx, const int* xstart, uint32_t ry)
+{
+  switch (fx) {
+  case 2: box_reduce_row<2, SPP> (d, c, nw, spp, xstart, ry); break;
+  case 4: box_reduce_row<4, SPP> (d, c, nw, spp, xstart, ry); break;
+  case 8: box_reduce_row<8, SPP> (d, c, nw, spp, xstart, ry); break;
+  default: box_reduce_row<0, SPP> (d, c, nw, spp, xstart, ry); break;
+  }
+}
+
 template <typename T>
 struct box_scale_template
 {
@@ -199,67 +274,109 @@ struct box_scale_template
     new_image.setResolution (new_image.w * image.resolutionX() / image.w,
 			     new_image.h * image.resolutionY() / image.h);
     
-    T src (image);
-    T dst (new_image);
-  
-    // prepare boxes
-#if defined(_MSC_VER) || defined(__clang__)
-    std::vector<typename T::accu> boxes(new_image.w);
-#else
-    typename T::accu boxes [new_image.w]; 
-#endif
+    const int nw = new_image.w, nh = new_image.h;
+    std::vector<int> xstart, ystart;
+    box_starts (image.w, nw, xstart);
+    box_starts (image.h, nh, ystart);
+    
+#pragma omp parallel
+    {
+      T src (image);
+      T dst (new_image);
+      std::vector<typename T::accu> boxes (nw);
+      
+#pragma omp for schedule (dynamic, 16)
+      for (int dy = 0; dy < nh; ++dy)
+	{
+	  // clear for accumulation
+	  for (int dx = 0; dx < nw; ++dx)
+	    boxes[dx] = typename T::accu();
+	  
+	  for (int sy = ystart[dy]; sy < ystart[dy + 1]; ++sy) {
+	    src.at (0, sy);
+	    for (int dx = 0; dx < nw; ++dx)
+	      for (int sx = xstart[dx]; sx < xstart[dx + 1]; ++sx) {
+		boxes[dx] += *src; ++src;
+	      }
+	  }
+	  
+	  // set box
+	  const int ry = ystart[dy + 1] - ystart[dy];
+	  dst.at (0, dy);
+	  for (int dx = 0; dx < nw; ++dx) {
+	    const int count = (xstart[dx + 1] - xstart[dx]) * ry;
+	    if (count)
+	      boxes[dx] /= count;
+	    dst.set (boxes[dx]);
+	    ++dst;
+	  }
+	}
+    }
+  }
+};
 
-#if defined(_MSC_VER)
-    std::vector<int> count(new_image.w);
-    std::vector<int> bindex(image.w); // pre-computed box-indexes
-#else
-    int count [new_image.w];
-    int bindex [image.w]; // pre-computed box indexes
-#endif
-    for (int sx = 0; sx < image.w; ++sx) {
-      bindex[sx] = sx * new_image.w / image.w;
-      //std::cerr << sx << " -> " << bindex[sx] << std::endl;
-    } 
-    int dy = 0;
-    for (int sy = 0; dy < new_image.h && sy < image.h; ++dy)
+// 8 bit samples: sum the source rows of each destination row column wise
+// (vectorizable), then reduce the column sums box by box
+static void box_scale_8bit (Image& new_image, double scalex, double scaley, bool fixed)
+{
+  if (!fixed) {
+    scalex = (int)(scalex * new_image.w);
+    scaley = (int)(scaley * new_image.h);
+  }
+  
+  Image image;
+  image.copyTransferOwnership (new_image);
+  
+  new_image.resize (scalex, scaley);
+  new_image.setResolution (new_image.w * image.resolutionX() / image.w,
+			   new_image.h * image.resolutionY() / image.h);
+  
+  const int spp = image.spp, samples = image.w * spp;
+  const int nw = new_image.w, nh = new_image.h;
+  const unsigned sstride = image.stride(), dstride = new_image.stride();
+  const uint8_t* src = image.getRawData();
+  uint8_t* dst = new_image.getRawData();
+  
+  std::vector<int> xstart, ystart;
+  box_starts (image.w, nw, xstart);
+  box_starts (image.h, nh, ystart);
+  const int fx = image.w % nw == 0 ? image.w / nw : 0;
+  
+#pragma omp parallel
+  {
+    std::vector<uint32_t> colsum (samples);
+    
+#pragma omp for schedule (dynamic, 16)
+    for (int dy = 0; dy < nh; ++dy)
       {
-	// clear for accumulation
-	for (int x = 0; x < new_image.w; ++x) {
-	  boxes[x] = typename T::accu();
-	  count[x] = 0;
+	uint32_t* c = &colsum[0];
+	for (int x = 0; x < samples; ++x)
+	  c[x] = 0;
+	for (int sy = ystart[dy]; sy < ystart[dy + 1]; ++sy) {
+	  const uint8_t* s = src + sy * sstride;
+	  for (int x = 0; x < samples; ++x)
+	    c[x] += s[x];
 	}
-	
-	for (; sy < image.h &&
-	       sy * new_image.h / image.h < dy + 1;
-	     ++sy) {
-	  //std::cout << "sy: " << sy << " -> " << dy << std::endl;
-	  src.at(0, sy);
-	  for (int sx = 0; sx < image.w; ++sx) {
-	    //std::cout << "sx: " << sx << " -> " << dx << std::endl;
-	    const int dx = bindex[sx];
-	    boxes[dx] += *src; ++src;
-	    ++count[dx];
-	  }
-	}
-	
-	// set box
-	//std::cout << "dy: " << dy << " from " << new_image.h << std::endl;
-	for (int dx = 0; dx < new_image.w; ++dx) {
-	  //std::cout << "setting: dx: " << dx << ", from: " << new_image.w
-	  //    << ", count: " << count[dx] << std::endl;      
-	  boxes[dx] /= count[dx];
-	  dst.set (boxes[dx]);
-	  ++dst;
+	uint8_t* d = dst + dy * dstride;
+	const uint32_t ry = ystart[dy + 1] - ystart[dy];
+	switch (spp) {
+	case 1: box_reduce<1> (d, c, nw, spp, fx, &xstart[0], ry); break;
+	case 3: box_reduce<3> (d, c, nw, spp, fx, &xstart[0], ry); break;
+	case 4: box_reduce<4> (d, c, nw, spp, fx, &xstart[0], ry); break;
+	default: box_reduce<0> (d, c, nw, spp, fx, &xstart[0], ry); break;
 	}
       }
   }
-};
+}
 
 void box_scale (Image& image, double scalex, double scaley, bool fixed)
 {
   if (scalex == 1.0 && scaley == 1.0 && !fixed)
     return;
-  codegen<box_scale_template> (image, scalex, scaley, fixed);
+  if (image.bps == 8)
+    box_scale_8bit (image, scalex, scaley, fixed);
+  else
+    codegen<box_scale_template> (image, scalex, scaley, fixed);
 }
 
 inline Image::iterator CubicConvolution (int distance,
@@ -281,11 +398,9 @@ inline Image::iterator CubicConvolution (int distance,
    0 0 -13.5 6
    0 0 6.1 -2.45 */
 
-void bicubic_scale (Image& new_image, double scalex, double scaley, bool fixed)
+// generic, but slow and effectively bi-linear, only used for sub-byte data
+static void bicubic_scale_iterator (Image& new_image, double scalex, double scaley, bool fixed)
 {
-  if (scalex == 1.0 && scaley == 1.0 && !fixed)
-    return;
-  
   if (!fixed) {
     scalex = (int)(scalex * new_image.w);
     scaley = (int)(scaley * new_image.h);
@@ -343,6 +458,217 @@ void bicubic_scale (Image& new_image, double scalex, double scaley, bool fixed)
     }
   }
 }
+
+/* Separable polyphase resampling: the filter taps and weights of every
+   output column and row are computed once, in 14 bit fixed point. Each
+   output row is the vertical filter over the source rows, followed by
+   the horizontal filter. On downscale the filter is widened by the
+   inverse scale factor to low-pass (anti-alias) the source. The inner
+   loops are plain and contiguous, for the compiler to vectorize. */
+
+static double filter_bicubic (double x) // Catmull-Rom, a = -0.5
+{
+  x = fabs(x);
+  if (x < 1)
+    return (1.5 * x - 2.5) * x * x + 1;
+  if (x < 2)
+    return ((-0.5 * x + 2.5) * x - 4) * x + 2;
+  return 0;
+}
+
+static double filter_mitchell (double x) // Mitchell-Netravali, B = C = 1/3
+{
+  const double B = 1. / 3, C = 1. / 3;
+  x = fabs(x);
+  if (x < 1)
+    return ((12 - 9 * B - 6 * C) * x * x * x +
+	    (-18 + 12 * B + 6 * C) * x * x + (6 - 2 * B)) / 6;
+  if (x < 2)
+    return ((-B - 6 * C) * x * x * x + (6 * B + 30 * C) * x * x +
+	    (-12 * B - 48 * C) * x + (8 * B + 24 * C)) / 6;
+  return 0;
+}
+
+static double sinc (double x)
+{
+  if (x == 0)
+    return 1;
+  x *= M_PI;
+  return sin(x) / x;
+}
+
+static double filter_lanczos3 (double x)
+{
+  x = fabs(x);
+  return x < 3 ? sinc(x) * sinc(x / 3) : 0;
+}
+
+static const int resample_bits = 14;
+
+struct resample_weights
+{
+  // stride: multiplier of the source index, e.g. samples per pixel
+  resample_weights (int src, int dst, int stride,
+		    double (*filter)(double), double radius)
+  {
+    const double scale = (double)dst / src;
+    const double fscale = std::min(scale, 1.0);
+    const double support = radius / fscale;
+    taps = (int)ceil(2 * support) + 1;
+    index.resize(dst * taps);
+    weight.resize(dst * taps);
+    
+    std::vector<double> w(taps);
+    for (int o = 0; o < dst; ++o) {
+      const double center = (o + .5) / scale - .5;
+      const int first = (int)ceil(center - support);
+      
+      double sum = 0;
+      for (int k = 0; k < taps; ++k) {
+	w[k] = filter((first + k - center) * fscale);
+	sum += w[k];
+      }
+      
+      int isum = 0, largest = 0;
+      for (int k = 0; k < taps; ++k) {
+	const int i = std::max(std::min(first + k, src - 1), 0);
+	int32_t& iw = weight[o * taps + k];
+	iw = (int32_t)floor(w[k] / sum * (1 << resample_bits) + .5);
+	isum += iw;
+	if (iw > weight[o * taps + largest])
+	  largest = k;
+	index[o * taps + k] = i * stride;
+      }
+      // normalize the rounding error away, to keep flat areas flat
+      weight[o * taps + largest] += (1 << resample_bits) - isum;
+    }
+  }
+  
+  int taps;
+  std::vector<int> index;
+  std::vector<int32_t> weight;
+};
+
+// horizontal pass of one row, SPP specialized for the common gray, RGB
+// and RGBA data for the compiler to unroll, 0 for the generic case
+template <typename T, typename A, int SPP>
+static inline void resample_row (T* d, const A* r, int w, int spp,
+				 const resample_weights& xw, int hshift, A maxval)
+{
+  if (SPP)
+    spp = SPP;
+  for (int x = 0; x < w; ++x) {
+    const int* xi = &xw.index[x * xw.taps];
+    const int32_t* xwt = &xw.weight[x * xw.taps];
+    for (int c = 0; c < spp; ++c) {
+      A acc = (A)1 << (hshift - 1);
+      for (int k = 0; k < xw.taps; ++k)
+	acc += r[xi[k] + c] * xwt[k];
+      acc >>= hshift;
+      *d++ = (T)std::max(std::min(acc, maxval), (A)0);
+    }
+  }
+}
+
+// T: sample type, A: accumulator, vshift: bits dropped after the vertical pass
+template <typename T, typename A, int vshift>
+static void resample (Image& new_image, const Image& image,
+		      const resample_weights& xw, const resample_weights& yw)
+{
+  const int spp = image.spp;
+  const int samples = image.w * spp;
+  const unsigned sstride = image.stride(), dstride = new_image.stride();
+  const uint8_t* src = image.getRawData();
+  uint8_t* dst = new_image.getRawData();
+  const A maxval = (A)((1 << (sizeof(T) * 8)) - 1);
+  const int hshift = 2 * resample_bits - vshift;
+  
+#pragma omp parallel
+  {
+    std::vector<A> row(samples);
+    
+#pragma omp for schedule (dynamic, 16)
+    for (int y = 0; y < new_image.h; ++y)
+      {
+	A* r = &row[0];
+	const int* yi = &yw.index[y * yw.taps];
+	const int32_t* ywt = &yw.weight[y * yw.taps];
+	
+	for (int x = 0; x < samples; ++x)
+	  r[x] = 0;
+	for (int k = 0; k < yw.taps; ++k) {
+	  const A wk = ywt[k];
+	  if (!wk)
+	    continue;
+	  const T* s = (const T*)(src + yi[k] * sstride);
+	  for (int x = 0; x < samples; ++x)
+	    r[x] += (A)s[x] * wk;
+	}
+	if (vshift)
+	  for (int x = 0; x < samples; ++x)
+	    r[x] = (r[x] + (1 << (vshift - 1))) >> vshift;
+	
+	T* d = (T*)(dst + y * dstride);
+	switch (spp) {
+	case 1: resample_row<T, A, 1> (d, r, new_image.w, spp, xw, hshift, maxval); break;
+	case 3: resample_row<T, A, 3> (d, r, new_image.w, spp, xw, hshift, maxval); break;
+	case 4: resample_row<T, A, 4> (d, r, new_image.w, spp, xw, hshift, maxval); break;
+	default: resample_row<T, A, 0> (d, r, new_image.w, spp, xw, hshift, maxval); break;
+	}
+      }
+  }
+}
+
+void resample_scale (Image& new_image, double scalex, double scaley,
+		     resample_filter_t filter, bool fixed)
+{
+  if (scalex == 1.0 && scaley == 1.0 && !fixed)
+    return;
+  
+  if (!fixed) {
+    scalex = (int)(scalex * new_image.w);
+    scaley = (int)(scaley * new_image.h);
+  }
+  const int w = std::max((int)scalex, 1), h = std::max((int)scaley, 1);
+  
+  // sub-byte data is resampled as gray8, the result is shaded anyway
+  if (new_image.bps < 8)
+    colorspace_by_name (new_image, "gray8");
+  
+  double (*f)(double) = filter_bicubic;
+  double radius = 2;
+  switch (filter) {
+  case RESAMPLE_LANCZOS3: f = filter_lanczos3; radius = 3; break;
+  case RESAMPLE_MITCHELL: f = filter_mitchell; break;
+  default: break;
+  }
+  
+  Image image;
+  image.copyTransferOwnership (new_image);
+  
+  new_image.resize (w, h);
+  new_image.setResolution (new_image.w * image.resolutionX() / image.w,
+			   new_image.h * image.resolutionY() / image.h);
+  
+  resample_weights xw (image.w, new_image.w, image.spp, f, radius);
+  resample_weights yw (image.h, new_image.h, 1, f, radius);
+  
+  if (image.bps == 16)
+    resample<uint16_t, int64_t, 0> (new_image, image, xw, yw);
+  else
+    resample<uint8_t, int32_t, 7> (new_image, image, xw, yw);
+}
+
+void bicubic_scale (Image& image, double scalex, double scaley, bool fixed)
+{
+  if (scalex == 1.0 && scaley == 1.0 && !fixed)
+    return;
+  
+  if (image.bps < 8)
+    bicubic_scale_iterator (image, scalex, scaley, fixed);
+  else
+    resample_scale (image, scalex, scaley, RESAMPLE_BICUBIC, fixed);
+}
 #ifndef _MSC_VER
 
 template <typename T>
@@ -561,73 +887,81 @@ void box_scale_grayX_to_gray8 (Image& new_image, double scalex, double scaley, b
   Image image;
   image.copyTransferOwnership (new_image);
   
+  new_image.setBitsPerSample (8);
   new_image.resize (scalex, scaley);
   new_image.setResolution (new_image.w * image.resolutionX() / image.w,
 			   new_image.h * image.resolutionY() / image.h);
   
-  uint8_t* src = image.getRawData();
+  const int bps = image.bps, w = image.w;
+  const int nw = new_image.w, nh = new_image.h;
+  const unsigned sstride = image.stride(), dstride = new_image.stride();
+  const uint8_t* src = image.getRawData();
   uint8_t* dst = new_image.getRawData();
   
-#ifdef _MSC_VER
-  std::vector<uint32_t> boxes(new_image.w);
-  std::vector<uint32_t> count(new_image.w);
-  std::vector<int> bindex(image.w);
-#else
-  uint32_t boxes[new_image.w];
-  uint32_t count[new_image.w];
-  // pre-compute box indexes
-  int bindex [image.w];
-#endif
-  for (int sx = 0; sx < image.w; ++sx)
-    bindex[sx] = std::min ((int)(scalex * sx), new_image.w - 1);
+  std::vector<int> xstart, ystart;
+  box_starts (w, nw, xstart);
+  box_starts (image.h, nh, ystart);
+  const int fx = w % nw == 0 ? w / nw : 0;
   
-  const int bps = image.bps;
-  const int vmax = 1 << bps;
-#ifdef _MSC_VER
-  std::vector<uint8_t> gray_lookup(vmax);
-#else
-  uint8_t gray_lookup[vmax];
-#endif
-  for (int i = 0; i < vmax; ++i) {
-    gray_lookup[i] = 0xff * i / (vmax - 1);
-    //std::cerr << i << " = " << (int)gray_lookup[i] << std::endl;
-  }
+  // sub-byte rows are expanded to gray8 a whole byte at-a-time
+  const int ppb = 8 / bps, vmax = (1 << bps) - 1;
+  std::vector<uint8_t> expand (bps < 8 ? 256 * ppb : 0);
+  for (int i = 0; bps < 8 && i < 256; ++i)
+    for (int j = 0; j < ppb; ++j)
+      expand[i * ppb + j] = 0xff * ((i >> (8 - bps * (j + 1))) & vmax) / vmax;
   
-  const unsigned int bitshift = 8 - bps;
+  // byte aligned 1 bit boxes just count the set bits
+  const bool bits = bps == 1 && fx && fx % 8 == 0;
+  const int n = bits ? w / 8 : w;
   
-  int dy = 0;
-  for (int sy = 0; dy < new_image.h && sy < image.h; ++dy)
-    {
-      // clear for accumulation
-      memset (&boxes[0], 0, sizeof(boxes));
-      memset (&count[0], 0, sizeof(count));
-      
-      for (; sy < image.h && sy * scaley < dy + 1; ++sy)
-	{
-	  uint8_t z = 0;
-	  unsigned int bits = 0;
-	  
-	  for (int sx = 0; sx < image.w; ++sx)
-	    {
-	      if (bits == 0) {
-		z = *src++;
-		bits = 8;
-	      }
-	      
-	      const int dx = bindex[sx];
-	      boxes[dx] += gray_lookup[z >> bitshift];
-	      ++count[dx];
-	      
-	      z <<= bps;
-	      bits -= bps;
+#pragma omp parallel
+  {
+    std::vector<uint32_t> colsum (n);
+    std::vector<uint8_t> row (bps < 8 ? sstride * ppb : 0);
+    
+#pragma omp for schedule (dynamic, 16)
+    for (int dy = 0; dy < nh; ++dy)
+      {
+	uint32_t* c = &colsum[0];
+	for (int x = 0; x < n; ++x)
+	  c[x] = 0;
+	
+	for (int sy = ystart[dy]; sy < ystart[dy + 1]; ++sy)
+	  {
+	    const uint8_t* s = src + sy * sstride;
+	    if (bits) {
+	      for (int x = 0; x < n; ++x)
+		c[x] += Exact::popcount[s[x]];
+	      continue;
 	    }
+	    
+	    if (bps < 8) {
+	      uint8_t* r = &row[0];
+	      for (unsigned x = 0; x < sstride; ++x, r += ppb)
+		for (int j = 0; j < ppb; ++j)
+		  r[j] = expand[s[x] * ppb + j];
+	      s = &row[0];
+	    }
+	    for (int x = 0; x < w; ++x)
+	      c[x] += s[x];
+	  }
+	
+	uint8_t* d = dst + dy * dstride;
+	const uint32_t ry = ystart[dy + 1] - ystart[dy];
+	if (bits) {
+	  const int fb = fx / 8;
+	  const uint64_t count = fx * ry;
+	  for (int dx = 0; dx < nw; ++dx, c += fb) {
+	    uint64_t sum = 0;
+	    for (int i = 0; i < fb; ++i)
+	      sum += c[i];
+	    d[dx] = count ? sum * 0xff / count : 0;
+	  }
 	}
-      
-      for (int dx = 0; dx < new_image.w; ++dx) {
-	*dst = (boxes[dx] / count[dx]);
-	++dst;
+	else
+	  box_reduce<1> (d, c, nw, 1, fx, &xstart[0], ry);
       }
-    }
+  }
 }
 
 void thumbnail_scale (Image& image, double scalex, double scaley, bool fixed)
@@ -638,8 +972,10 @@ void thumbnail_scale (Image& image, double scalex, double scaley, bool fixed)
   
   // thru the codec?
   if (!image.isModified() && image.getCodec())
-    if (image.getCodec()->scale(image, scalex, scaley, fixed))
+    if (image.getCodec()->scale(image, scalex, scaley, fixed)) {
+      profile_codec_fast_path ();
       return;
+    }
   
   // quick sub byte scaling
   if (image.bps <= 8 && image.spp == 1) {
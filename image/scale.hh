@@ -22,6 +22,11 @@
 // pick the best
 void scale (Image& image, double xscale, double yscale, bool fixed = false);
 
+// the named method, e.g. "bilinear" or "lanczos", or the best if empty,
+// false if the name is not known
+bool scale_by_name (Image& image, const std::string& method,
+		    double xscale, double yscale, bool fixed = false);
+
 // explicit versions
 void nearest_scale (Image& image, double xscale, double yscale, bool fixed = false);
 void box_scale (Image& image, double xscale, double yscale, bool fixed = false);
@@ -29,6 +34,16 @@ void box_scale (Image& image, double xscale, double yscale, bool fixed = false);
 void bilinear_scale (Image& image, double xscale, double yscale, bool fixed = false);
 void bicubic_scale (Image& image, double xscale, double yscale, bool fixed = false);
 
+// separable, anti-aliased resampling with the selected filter kernel
+typedef enum {
+  RESAMPLE_BICUBIC,
+  RESAMPLE_LANCZOS3,
+  RESAMPLE_MITCHELL
+} resample_filter_t;
+
+void resample_scale (Image& image, double xscale, double yscale,
+		     resample_filter_t filter = RESAMPLE_BICUBIC, bool fixed = false);
+
 void ddt_scale (Image& image, double xscale, double yscale, bool fixed = false, bool extended = true);
 
 void thumbnail_scale (Image& image, double xscale, double yscale, bool fixed = false);
@@ -239,8 +239,36 @@ static const char* fonts[] = {
  "/usr/X11/share/fonts/TTF/Vera.ttf",
 };
 
+/* One process-wide FreeType engine and glyph cache. The engine keeps up
+   to max_faces faces open and re-selects them by name, the manager keeps
+   the rendered glyphs of up to max_fonts face, size and hinting variants
+   and drops the oldest when more are used. Thus faces are loaded and
+   glyphs rasterized once, not on every drawText call. The manager is not
+   re-entrant (e.g. its embedded adaptors hold the current glyph), hence
+   all text rendering is serialized in the font_cache critical section. */
+
+static const unsigned max_faces = 32;
+static const unsigned max_fonts = 32;
+
+static font_engine_type& font_engine ()
+{
+  static font_engine_type feng (max_faces);
+  return feng;
+}
+
+static font_manager_type& font_manager ()
+{
+  static font_manager_type fman (font_engine (), max_fonts);
+  return fman;
+}
+
 static bool load_font(font_engine_type& m_feng, const char* fontfile)
 {
+  // the first of our default fonts found, not probed over and over again
+  static const char* default_font = 0;
+  if (!fontfile)
+    fontfile = default_font;
+  
   if (fontfile) {
     if (m_feng.load_font (fontfile, 0, gren))
       return true;
@@ -251,8 +279,10 @@ static bool load_font(font_engine_type& m_feng, const char* fontfile)
   else {
     for (unsigned int i = 0; i < ARRAY_SIZE(fonts); ++i)
       {
-	if (m_feng.load_font (fonts[i], 0, gren))
+	if (m_feng.load_font (fonts[i], 0, gren)) {
+	  default_font = fonts[i];
 	  return true;
+	}
 	
 	std::cerr << "failed to load ttf font: " << fonts[i] << std::endl;
       }
@@ -277,8 +307,8 @@ bool Path::drawText (Image& image, const char* text, double height,
   renderer_bin ren_bin (ren_base);
   ren_bin.color (agg::rgba (r, g, b, a));
   
-  font_engine_type m_feng;
-  font_manager_type m_fman (m_feng);
+  font_engine_type& m_feng = font_engine ();
+  font_manager_type& m_fman = font_manager ();
  
   mtx *= agg::trans_affine_translation(path.last_x(), path.last_y());
   
@@ -293,99 +323,109 @@ bool Path::drawText (Image& image, const char* text, double height,
   m_stroke.width(line_width);
   agg::conv_transform<agg::conv_stroke<agg::conv_curve<font_manager_type::path_adaptor_type> > >
     m_stroke_mtx(m_stroke, mtx);
- 
-  m_feng.height (height);
-  if (!load_font(m_feng, fontfile))
-    return false;
-  
-  m_feng.hinting (hinting);
-  m_feng.height (height);
-  m_feng.flip_y (true);
-  
   
   agg::rect_d bbox(0, 0, -1, -1);
   
   std::vector<uint32_t> utf8 = DecodeUtf8(text, strlen(text));
   double x = 0, y = 0;
-  for (unsigned int i = 0, n = 0; i < utf8.size(); ++i)
-    {
-      switch (utf8[i]) {
-      case '\n':
-	n = 0;
-	x = path.last_x();
-	y += height * 1.2;
-	continue;
+  bool loaded;
+  
+#pragma omp critical (font_cache)
+  {
+    m_feng.height (height);
+    loaded = load_font(m_feng, fontfile);
+    
+    if (loaded)
+      {
+	m_feng.hinting (hinting);
+	m_feng.height (height);
+	m_feng.flip_y (true);
+	m_fman.reset_last_glyph (); // no kerning with the previous text
 	
-      case '\t':
-	{
-	  const agg::glyph_cache* glyph = m_fman.glyph(' ');
-	  int skip = 8 - n % 8;
-	  x += glyph->advance_x * skip;
-	  y += glyph->advance_y * skip;
-	  n += skip;
-	}
-	continue;
-      }
-      
-      const agg::glyph_cache* glyph = m_fman.glyph(utf8[i]);
-      if (glyph)
-	{
-	  if (kerning)
-	    m_fman.add_kerning(&x, &y);
-	  m_fman.init_embedded_adaptors(glyph, x, y);
-
-	  switch (glyph->data_type)
-	    {
-	    case agg::glyph_data_mono:
-	      if (!w && !h)
-		agg::render_scanlines (m_fman.mono_adaptor(), 
-				       m_fman.mono_scanline(), 
-				       ren_bin);
-	      break;
-
-	    case agg::glyph_data_gray8:
-	      if (!w && !h)
-		agg::render_scanlines (m_fman.gray8_adaptor(), 
-				       m_fman.gray8_scanline(), 
-				       ren_solid);
-	      break;
-
-	    case agg::glyph_data_outline:
-	      if (fill != fill_none) {
-		if (w && h) {
-		  agg::rect_d r;
-		  agg::bounding_rect_single(m_curves_mtx, 0,
-					    &r.x1, &r.y1, &r.x2, &r.y2);
-		  if (!bbox.is_valid())
-		    bbox = r;
-		  else
-		    bbox = agg::unite_rectangles(bbox, r);
-		} else
-		  ras.add_path (m_curves_mtx);
-	      }
-	      else {
-		if (w && h) {
-		  agg::rect_d r;
-		  agg::bounding_rect_single(m_stroke_mtx, 0,
-					    &r.x1, &r.y1, &r.x2, &r.y2);
-		  if (!bbox.is_valid())
-		    bbox = r;
-		  else
-		    bbox = agg::unite_rectangles(bbox, r);
-		} else
-		  ras.add_path (m_stroke_mtx);
-	      }
-	      break;
+	for (unsigned int i = 0, n = 0; i < utf8.size(); ++i)
+	  {
+	    switch (utf8[i]) {
+	    case '\n':
+	      n = 0;
+	      x = path.last_x();
+	      y += height * 1.2;
+	      continue;
 	      
-	    default:
-	      break;
+	    case '\t':
+	      {
+		const agg::glyph_cache* glyph = m_fman.glyph(' ');
+		int skip = 8 - n % 8;
+		x += glyph->advance_x * skip;
+		y += glyph->advance_y * skip;
+		n += skip;
+	      }
+	      continue;
 	    }
-
-	  // increment pen position
-	  x += glyph->advance_x;
-	  y += glyph->advance_y;
-	}
-    }
+	    
+	    const agg::glyph_cache* glyph = m_fman.glyph(utf8[i]);
+	    if (glyph)
+	      {
+		if (kerning)
+		  m_fman.add_kerning(&x, &y);
+		m_fman.init_embedded_adaptors(glyph, x, y);
+		
+		switch (glyph->data_type)
+		  {
+		  case agg::glyph_data_mono:
+		    if (!w && !h)
+		      agg::render_scanlines (m_fman.mono_adaptor(), 
+					     m_fman.mono_scanline(), 
+					     ren_bin);
+		    break;
+		    
+		  case agg::glyph_data_gray8:
+		    if (!w && !h)
+		      agg::render_scanlines (m_fman.gray8_adaptor(), 
+					     m_fman.gray8_scanline(), 
+					     ren_solid);
+		    break;
+		    
+		  case agg::glyph_data_outline:
+		    if (fill != fill_none) {
+		      if (w && h) {
+			agg::rect_d r;
+			agg::bounding_rect_single(m_curves_mtx, 0,
+						  &r.x1, &r.y1, &r.x2, &r.y2);
+			if (!bbox.is_valid())
+			  bbox = r;
+			else
+			  bbox = agg::unite_rectangles(bbox, r);
+		      } else
+			ras.add_path (m_curves_mtx);
+		    }
+		    else {
+		      if (w && h) {
+			agg::rect_d r;
+			agg::bounding_rect_single(m_stroke_mtx, 0,
+						  &r.x1, &r.y1, &r.x2, &r.y2);
+			if (!bbox.is_valid())
+			  bbox = r;
+			else
+			  bbox = agg::unite_rectangles(bbox, r);
+		      } else
+			ras.add_path (m_stroke_mtx);
+		    }
+		    break;
+		    
+		  default:
+		    break;
+		  }
+		
+		// increment pen position
+		x += glyph->advance_x;
+		y += glyph->advance_y;
+	      }
+	  }
+      }
+  }
+  
+  if (!loaded)
+    return false;
   
   if (w || h) {
     *w = bbox.x2 - bbox.x1 + 1;
@@ -425,15 +465,8 @@ bool Path::drawTextOnPath (Image& image, const char* text, double height,
   tcurve.add_path (smooth);
   // tcurve.preserve_x_scale(m_preserve_x_scale.status());
   
-  font_engine_type m_feng;
-  font_manager_type m_fman (m_feng);
-  
-  // Pipeline to process the vectors glyph paths
-  agg::conv_curve<font_manager_type::path_adaptor_type> m_curves (m_fman.path_adaptor());
-  
-  m_feng.height (height);
-  if (!load_font(m_feng, fontfile))
-      return false;
+  font_engine_type& m_feng = font_engine ();
+  font_manager_type& m_fman = font_manager ();
   
   // Transform pipeline
   typedef agg::conv_curve<font_manager_type::path_adaptor_type> conv_font_curve_type;
@@ -446,54 +479,69 @@ bool Path::drawTextOnPath (Image& image, const char* text, double height,
   fsegm.approximation_scale (3.0);
   fcurves.approximation_scale (2.0);
   
-  m_feng.hinting (hinting);
-  m_feng.height (height);
-  m_feng.flip_y (true);
-  
   ras.reset ();
   
   double x = 0, y = 0;
   
   std::vector<uint32_t> utf8 = DecodeUtf8(text, strlen(text));
-  for (unsigned int i = 0, n = 0; i < utf8.size(); ++i)
-    {
-      switch (utf8[i]) {
-      case '\n':
-	n = 0;
-	x = 0;
-	y += height * 1.2;
-	continue;
-      case '\t':
-	{
-	  const agg::glyph_cache* glyph = m_fman.glyph(' ');
-	  int skip = 8 - n % 8;
-	  x += glyph->advance_x * skip;
-	  y += glyph->advance_y * skip;
-	  n += skip;
-	}
-	continue;
-      }
-      
-      const agg::glyph_cache* glyph = m_fman.glyph(utf8[i]);
-      if (glyph)
-	{
-	  if (kerning)
-	    m_fman.add_kerning(&x, &y);
-	  
-	  m_fman.init_embedded_adaptors(glyph, x, y);
-	  
-	  if (glyph->data_type == agg::glyph_data_outline)
-	    {
-	      ras.add_path (ftrans);
+  bool loaded;
+  
+#pragma omp critical (font_cache)
+  {
+    m_feng.height (height);
+    loaded = load_font(m_feng, fontfile);
+    
+    if (loaded)
+      {
+	m_feng.hinting (hinting);
+	m_feng.height (height);
+	m_feng.flip_y (true);
+	m_fman.reset_last_glyph (); // no kerning with the previous text
+	
+	for (unsigned int i = 0, n = 0; i < utf8.size(); ++i)
+	  {
+	    switch (utf8[i]) {
+	    case '\n':
+	      n = 0;
+	      x = 0;
+	      y += height * 1.2;
+	      continue;
+	    case '\t':
+	      {
+		const agg::glyph_cache* glyph = m_fman.glyph(' ');
+		int skip = 8 - n % 8;
+		x += glyph->advance_x * skip;
+		y += glyph->advance_y * skip;
+		n += skip;
+	      }
+	      continue;
 	    }
-	  else
-	    std::cerr << "Warning: unexpected glyph type!" << std::endl;
-	  
-	  // increment pen position
-	  x += glyph->advance_x;
-	  y += glyph->advance_y;
-	}
-    }
+	    
+	    const agg::glyph_cache* glyph = m_fman.glyph(utf8[i]);
+	    if (glyph)
+	      {
+		if (kerning)
+		  m_fman.add_kerning(&x, &y);
+		
+		m_fman.init_embedded_adaptors(glyph, x, y);
+		
+		if (glyph->data_type == agg::glyph_data_outline)
+		  {
+		    ras.add_path (ftrans);
+		  }
+		else
+		  std::cerr << "Warning: unexpected glyph type!" << std::endl;
+		
+		// increment pen position
+		x += glyph->advance_x;
+		y += glyph->advance_y;
+	      }
+	  }
+      }
+  }
+  
+  if (!loaded)
+    return false;
   
   agg::render_scanlines(ras, sl, ren_solid);
   image.setRawData(); // invalidate cache